@@ -4,6 +4,11 @@
 #include "tracer.h"
 #include "corporeal.h"
 #include "material.h"
+#include "rayPacket.h"
+
+#ifdef __AVX2__
+#include <immintrin.h>
+#endif
 
 class AABB {
     public:
@@ -12,20 +17,39 @@ class AABB {
 
         Point3 min() const { return minimum; }
         Point3 max() const { return maximum; }
+
+        // Total area of the six faces, the probability of a random ray hitting a box scales with it.
+        double surfaceArea() const {
+            auto d = maximum - minimum;
+            return 2.0 * (d.x() * d.y() + d.y() * d.z() + d.z() * d.x());
+        }
        
+        bool contains(const Point3& p) const {
+            return p.x() >= minimum.x() && p.x() <= maximum.x() && p.y() >= minimum.y() && p.y() <= maximum.y()
+                && p.z() >= minimum.z() && p.z() <= maximum.z();
+        }
+
+        // Same slab test as hit, but narrows [tMin, tMax] down to the part of the ray inside the box.
+        bool clip(const Ray& r, double& tMin, double& tMax) const {
+            for (int i = 0; i < 3; i++) {
+                double t0 = (nearSide(r, i) - r.orig[i]) * r.invDir[i];
+                double t1 = (farSide(r, i) - r.orig[i]) * r.invDir[i];
+                tMin = t0 > tMin ? t0 : tMin;
+                tMax = t1 < tMax ? t1 : tMax;
+                if (tMax <= tMin) return false;
+            }
+            return true;
+        }
+
         bool hit(const Ray& r, double tMin, double tMax) const {
             // Loop over each axis
             for (int i = 0; i < 3; i++) {
-                auto invD = 1.0f / r.direction()[i];
-                // The first slab edge of the aabb slab method is the smallest coordinate of this axis 
-                //  minus the origin divided by the whole length (makes it into a percentage of total 
-                //  distance/time t). 
-                auto t0 = (minimum[i] - r.origin()[i]) * invD;
-                // The far slab edge is the maximum of the AABB minus the origin divided by d.
-                auto t1 = (maximum[i] - r.origin()[i]) * invD;
-
-                // Actually, if the ray is shooting from the other side then t1 will be the near hit and t0 the far hit, swap them.
-                if (invD < 0.0f) std::swap(t0, t1);
+                // The first slab edge of the aabb slab method is the coordinate of this axis the ray reaches first 
+                //  (the smallest if it travels in the positive direction) minus the origin divided by the whole 
+                //  length (makes it into a percentage of total distance/time t). The ray keeps the division ready.
+                auto t0 = (nearSide(r, i) - r.orig[i]) * r.invDir[i];
+                // The far slab edge is the other side of the AABB minus the origin divided by d.
+                auto t1 = (farSide(r, i) - r.orig[i]) * r.invDir[i];
                 
                 // Check whether there is an intersection. See https://youtu.be/8JJ-4JgR7Dg?t=1034 
                 //   for a good explanation and visualization of all this.
@@ -39,16 +63,18 @@ class AABB {
             }
             return true;
         }
+
+        // Which of the `active` rays of a packet hit the box, each within [tMin, tMax[i]].
+        uint32_t hit(const RayPacket& packet, uint32_t active, double tMin, const double tMax[]) const;
+        // True if no ray of the packet can hit the box within [tMin, tMax], judged from the range of the rays alone.
+        bool missedByAll(const RayPacket& packet, double tMin, double tMax) const;
        
         bool hitFrame(const Ray& r, double tMin, double tMax, HitRecord& rec) const {
             for (int i = 0; i < 3; i++) {
-                auto invD = 1.0f / r.direction()[i];
-                // The first slab edge of the aabb slab method is the smallest coordinate of this axis 
+                // The first slab edge of the aabb slab method is the side of the aabb the ray reaches first 
                 //      minus the origin divided by the direction vector
-                auto t0 = (minimum[i] - r.origin()[i]) * invD;
-                auto t1 = (maximum[i] - r.origin()[i]) * invD;
-
-                if (invD < 0.0f) std::swap(t0, t1);
+                auto t0 = (nearSide(r, i) - r.orig[i]) * r.invDir[i];
+                auto t1 = (farSide(r, i) - r.orig[i]) * r.invDir[i];
                 
                 if (t0 > tMin) tMin = t0;
                 if (t1 < tMax) tMax = t1;
@@ -68,13 +94,91 @@ class AABB {
             auto outwardNormal = Vec3(0,0,1);
             rec.setFaceNormal(r, outwardNormal);
             rec.matPtr = make_shared<Lambertian>(Color(1.0, 0.05, 0.05));;
+            // Filled in completely already.
+            rec.object = nullptr;
             return true;
         }
 
         Point3 minimum;
         Point3 maximum;
+
+    private:
+        // The side of the box along `axis` the ray reaches first, and the one it leaves through.
+        double nearSide(const Ray& r, int axis) const { return r.dirNegative[axis] ? maximum[axis] : minimum[axis]; }
+        double farSide(const Ray& r, int axis) const { return r.dirNegative[axis] ? minimum[axis] : maximum[axis]; }
 };
 
+/**
+ * The slab test for all rays of a packet at once, in float lanes. The distances from the origins to the planes are
+ * taken in double and only then rounded, so every distance comes out within a few float epsilons of the exact one
+ * however far box and rays are from the world origin. Loose on purpose: the far distance gets slack well above that,
+ * so rounding never makes a ray miss a box it touches, the primitives inside decide in double.
+ */
+uint32_t AABB::hit(const RayPacket& packet, uint32_t active, double tMin, const double tMax[]) const {
+    const float slack = 1.0f + 1e-5f;
+    alignas(32) float far[packetSize];
+    for (int i = 0; i < packetSize; i++) far[i] = (float)tMax[i];
+
+    #ifdef __AVX2__
+    // Plane minus origin for all eight rays, in double and then rounded to float lanes.
+    auto toPlane = [](double plane, const double* origin) {
+        __m256d p = _mm256_set1_pd(plane);
+        __m128 low = _mm256_cvtpd_ps(_mm256_sub_pd(p, _mm256_load_pd(origin)));
+        __m128 high = _mm256_cvtpd_ps(_mm256_sub_pd(p, _mm256_load_pd(origin + 4)));
+        return _mm256_insertf128_ps(_mm256_castps128_ps256(low), high, 1);
+    };
+    __m256 tNear = _mm256_set1_ps((float)tMin);
+    __m256 tFar = _mm256_load_ps(far);
+    for (int a = 0; a < 3; a++) {
+        __m256 invD = _mm256_load_ps(packet.invDirection[a]);
+        __m256 t0 = _mm256_mul_ps(toPlane(minimum[a], packet.origin[a]), invD);
+        __m256 t1 = _mm256_mul_ps(toPlane(maximum[a], packet.origin[a]), invD);
+        tNear = _mm256_max_ps(tNear, _mm256_min_ps(t0, t1));
+        tFar = _mm256_min_ps(tFar, _mm256_max_ps(t0, t1));
+    }
+    __m256 hits = _mm256_cmp_ps(tNear, _mm256_mul_ps(tFar, _mm256_set1_ps(slack)), _CMP_LE_OQ);
+    return active & (uint32_t)_mm256_movemask_ps(hits);
+    #else
+    uint32_t result = 0;
+    for (int i = 0; i < packetSize; i++) {
+        float tNear = (float)tMin, tFar = far[i];
+        for (int a = 0; a < 3; a++) {
+            float t0 = (float)(minimum[a] - packet.origin[a][i]) * packet.invDirection[a][i];
+            float t1 = (float)(maximum[a] - packet.origin[a][i]) * packet.invDirection[a][i];
+            tNear = std::max(tNear, std::min(t0, t1));
+            tFar = std::min(tFar, std::max(t0, t1));
+        }
+        if (tNear <= tFar * slack) result |= 1u << i;
+    }
+    return active & result;
+    #endif
+}
+
+/**
+ * Interval arithmetic over the packet: with the origins and inverse directions only known to lie within their range,
+ * works out the earliest any ray can enter the box and the latest any ray can leave it. If even those don't overlap,
+ * every ray misses and the whole subtree is skipped without looking at a single ray.
+ */
+bool AABB::missedByAll(const RayPacket& packet, double tMin, double tMax) const {
+    if (!packet.sameSigns) return false;
+    double enter = tMin, leave = tMax;
+    for (int a = 0; a < 3; a++) {
+        bool negative = packet.invMin[a] < 0;
+        double nearPlane = negative ? maximum[a] : minimum[a];
+        double farPlane = negative ? minimum[a] : maximum[a];
+        // The products' extremes lie at the ends of both ranges.
+        double n0 = nearPlane - packet.originMax[a], n1 = nearPlane - packet.originMin[a];
+        double f0 = farPlane - packet.originMax[a], f1 = farPlane - packet.originMin[a];
+        double earliest = std::min(std::min(n0 * packet.invMin[a], n0 * packet.invMax[a]),
+                                   std::min(n1 * packet.invMin[a], n1 * packet.invMax[a]));
+        double latest = std::max(std::max(f0 * packet.invMin[a], f0 * packet.invMax[a]),
+                                 std::max(f1 * packet.invMin[a], f1 * packet.invMax[a]));
+        enter = std::max(enter, earliest);
+        leave = std::min(leave, latest);
+    }
+    return enter > leave * (1 + 1e-9);
+}
+
 AABB surroundingBox(AABB box0, AABB box1) {
     Point3 small(fmin(box0.min().x(), box1.min().x()),
                 fmin(box0.min().y(), box1.min().y()),
@@ -4,6 +4,17 @@
 #include "tracer.h"
 #include "corporeal.h"
 
+/**
+ * Turns the density of a uniformly picked point on a flat surface into the density over solid angle of the direction
+ * towards it: the ray hit the surface at `t` along `direction` where its normal is `normal`.
+ */
+inline double planarPdf(double t, const Vec3& direction, const Vec3& normal, double area) {
+    double distanceSquared = t * t * direction.lengthSquared();
+    double cosine = fabs(dot(direction, normal)) / direction.length();
+    if (cosine == 0) return 0;
+    return distanceSquared / (cosine * area);
+}
+
 class XY_Rectangle : public Corporeal {
     public:
         XY_Rectangle() {}
@@ -11,6 +22,7 @@ class XY_Rectangle : public Corporeal {
             : x0(_x0), x1(_x1), y0(_y0), y1(_y1), k(_z), matPtr(mat) {};
 
         virtual bool hit (const Ray& r, double tMin, double tMax, HitRecord& rec) const override;
+        virtual void finishHit(const Ray& r, HitRecord& rec) const override;
 
         virtual bool boundingBox(double time0, double time1, AABB& outputBox) const override {
             // The bounding box must have a non-zero thickness in all dimensions
@@ -18,11 +30,81 @@ class XY_Rectangle : public Corporeal {
             return true;
         }
 
+        double area() const { return (x1 - x0) * (y1 - y0); }
+        virtual double pdfValue(const Point3& origin, const Vec3& direction) const override {
+            HitRecord rec;
+            if (!hit(Ray(origin, direction), 0.001, infinity, rec)) return 0;
+            return planarPdf(rec.t, direction, Vec3(0, 0, 1), area());
+        }
+        virtual Vec3 random(const Point3& origin) const override {
+            return Point3(randomDouble(x0, x1), randomDouble(y0, y1), k) - origin;
+        }
+
     public:
         shared_ptr<Material> matPtr;
         double x0, x1, y0, y1, k;
 };
 
+class XZ_Rectangle : public Corporeal {
+    public:
+        XZ_Rectangle() {}
+        XZ_Rectangle(double _x0, double _x1, double _z0, double _z1, double _y, shared_ptr<Material> mat)
+            : matPtr(mat), x0(_x0), x1(_x1), z0(_z0), z1(_z1), k(_y) {};
+
+        virtual bool hit (const Ray& r, double tMin, double tMax, HitRecord& rec) const override;
+        virtual void finishHit(const Ray& r, HitRecord& rec) const override;
+
+        virtual bool boundingBox(double time0, double time1, AABB& outputBox) const override {
+            // The bounding box must have a non-zero thickness in all dimensions
+            outputBox = AABB(Point3(x0, k-0.0001, z0), Point3(x1, k+0.0001, z1));
+            return true;
+        }
+
+        double area() const { return (x1 - x0) * (z1 - z0); }
+        virtual double pdfValue(const Point3& origin, const Vec3& direction) const override {
+            HitRecord rec;
+            if (!hit(Ray(origin, direction), 0.001, infinity, rec)) return 0;
+            return planarPdf(rec.t, direction, Vec3(0, 1, 0), area());
+        }
+        virtual Vec3 random(const Point3& origin) const override {
+            return Point3(randomDouble(x0, x1), k, randomDouble(z0, z1)) - origin;
+        }
+
+    public:
+        shared_ptr<Material> matPtr;
+        double x0, x1, z0, z1, k;
+};
+
+class YZ_Rectangle : public Corporeal {
+    public:
+        YZ_Rectangle() {}
+        YZ_Rectangle(double _y0, double _y1, double _z0, double _z1, double _x, shared_ptr<Material> mat)
+            : matPtr(mat), y0(_y0), y1(_y1), z0(_z0), z1(_z1), k(_x) {};
+
+        virtual bool hit (const Ray& r, double tMin, double tMax, HitRecord& rec) const override;
+        virtual void finishHit(const Ray& r, HitRecord& rec) const override;
+
+        virtual bool boundingBox(double time0, double time1, AABB& outputBox) const override {
+            // The bounding box must have a non-zero thickness in all dimensions
+            outputBox = AABB(Point3(k-0.0001, y0, z0), Point3(k+0.0001, y1, z1));
+            return true;
+        }
+
+        double area() const { return (y1 - y0) * (z1 - z0); }
+        virtual double pdfValue(const Point3& origin, const Vec3& direction) const override {
+            HitRecord rec;
+            if (!hit(Ray(origin, direction), 0.001, infinity, rec)) return 0;
+            return planarPdf(rec.t, direction, Vec3(1, 0, 0), area());
+        }
+        virtual Vec3 random(const Point3& origin) const override {
+            return Point3(k, randomDouble(y0, y1), randomDouble(z0, z1)) - origin;
+        }
+
+    public:
+        shared_ptr<Material> matPtr;
+        double y0, y1, z0, z1, k;
+};
+
 bool XY_Rectangle::hit(const Ray& r, double tMin, double tMax, HitRecord& rec) const {
     auto t = (k - r.origin().z()) / r.direction().z();
     if (tMin > t || t > tMax) return false;
@@ -31,14 +113,62 @@ bool XY_Rectangle::hit(const Ray& r, double tMin, double tMax, HitRecord& rec) c
     auto y = r.origin().y() + t * r.direction().y();
     if (x < x0 || x > x1 || y < y0 || y > y1) return false;
 
-    rec.u = (x - x0) / (x1 - x0);
-    rec.v = (y - y0) / (y1 - y0);
     rec.t = t;
+    rec.object = this;
+    return true;
+}
+
+void XY_Rectangle::finishHit(const Ray& r, HitRecord& rec) const {
+    rec.p = r.at(rec.t);
+    rec.u = (rec.p.x() - x0) / (x1 - x0);
+    rec.v = (rec.p.y() - y0) / (y1 - y0);
     auto outwardNormal = Vec3(0, 0, 1);
     rec.setFaceNormal(r, outwardNormal);
     rec.matPtr = matPtr;
-    rec.p = r.at(t);
+}
+
+bool XZ_Rectangle::hit(const Ray& r, double tMin, double tMax, HitRecord& rec) const {
+    auto t = (k - r.origin().y()) / r.direction().y();
+    if (tMin > t || t > tMax) return false;
+
+    auto x = r.origin().x() + t * r.direction().x();
+    auto z = r.origin().z() + t * r.direction().z();
+    if (x < x0 || x > x1 || z < z0 || z > z1) return false;
+
+    rec.t = t;
+    rec.object = this;
     return true;
 }
 
-#endif
\ No newline at end of file
+void XZ_Rectangle::finishHit(const Ray& r, HitRecord& rec) const {
+    rec.p = r.at(rec.t);
+    rec.u = (rec.p.x() - x0) / (x1 - x0);
+    rec.v = (rec.p.z() - z0) / (z1 - z0);
+    auto outwardNormal = Vec3(0, 1, 0);
+    rec.setFaceNormal(r, outwardNormal);
+    rec.matPtr = matPtr;
+}
+
+bool YZ_Rectangle::hit(const Ray& r, double tMin, double tMax, HitRecord& rec) const {
+    auto t = (k - r.origin().x()) / r.direction().x();
+    if (tMin > t || t > tMax) return false;
+
+    auto y = r.origin().y() + t * r.direction().y();
+    auto z = r.origin().z() + t * r.direction().z();
+    if (y < y0 || y > y1 || z < z0 || z > z1) return false;
+
+    rec.t = t;
+    rec.object = this;
+    return true;
+}
+
+void YZ_Rectangle::finishHit(const Ray& r, HitRecord& rec) const {
+    rec.p = r.at(rec.t);
+    rec.u = (rec.p.y() - y0) / (y1 - y0);
+    rec.v = (rec.p.z() - z0) / (z1 - z0);
+    auto outwardNormal = Vec3(1, 0, 0);
+    rec.setFaceNormal(r, outwardNormal);
+    rec.matPtr = matPtr;
+}
+
+#endif
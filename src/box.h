@@ -0,0 +1,133 @@
+#ifndef BOX_H
+#define BOX_H
+
+#include "tracer.h"
+#include "corporeal.h"
+#include "aabb.h"
+#include "aarect.h"
+
+/**
+ * An axis-aligned box as a single object. Instead of six rectangles in the BVH it is intersected with one slab test,
+ * which also says which face the ray entered or left through. Faces are numbered 2 * axis for the low side and
+ * 2 * axis + 1 for the high side.
+ */
+class Box : public Corporeal {
+    public:
+        Box() {}
+        Box(const Point3& p0, const Point3& p1, shared_ptr<Material> mat) : matPtr(mat) {
+            for (int a = 0; a < 3; a++) {
+                boxMin[a] = fmin(p0[a], p1[a]);
+                boxMax[a] = fmax(p0[a], p1[a]);
+            }
+        }
+
+        virtual bool hit(const Ray& r, double tMin, double tMax, HitRecord& rec) const override;
+        virtual void finishHit(const Ray& r, HitRecord& rec) const override;
+        virtual bool boundingBox(double time0, double time1, AABB& outputBox) const override {
+            outputBox = AABB(boxMin, boxMax);
+            return true;
+        }
+
+        // Area of one of the two faces perpendicular to `axis`.
+        double faceArea(int axis) const {
+            Vec3 size = boxMax - boxMin;
+            return size[(axis + 1) % 3] * size[(axis + 2) % 3];
+        }
+        double area() const { return 2 * (faceArea(0) + faceArea(1) + faceArea(2)); }
+        virtual double pdfValue(const Point3& origin, const Vec3& direction) const override;
+        virtual Vec3 random(const Point3& origin) const override;
+
+        Vec3 faceNormal(int face) const {
+            Vec3 normal(0, 0, 0);
+            normal[face / 2] = face % 2 ? 1 : -1;
+            return normal;
+        }
+
+    public:
+        Point3 boxMin;
+        Point3 boxMax;
+        shared_ptr<Material> matPtr;
+
+    private:
+        // Where the ray's line enters and leaves the box, and through which faces. False if it misses.
+        bool slabs(const Ray& r, double& tNear, int& nearFace, double& tFar, int& farFace) const;
+};
+
+bool Box::slabs(const Ray& r, double& tNear, int& nearFace, double& tFar, int& farFace) const {
+    tNear = -infinity;
+    tFar = infinity;
+    nearFace = farFace = 0;
+    for (int a = 0; a < 3; a++) {
+        double t0 = (boxMin[a] - r.orig[a]) * r.invDir[a];
+        double t1 = (boxMax[a] - r.orig[a]) * r.invDir[a];
+        int face0 = 2 * a;
+        int face1 = 2 * a + 1;
+        if (r.dirNegative[a]) {
+            std::swap(t0, t1);
+            std::swap(face0, face1);
+        }
+        if (t0 > tNear) { tNear = t0; nearFace = face0; }
+        if (t1 < tFar) { tFar = t1; farFace = face1; }
+    }
+    return tNear <= tFar;
+}
+
+bool Box::hit(const Ray& r, double tMin, double tMax, HitRecord& rec) const {
+    double tNear, tFar;
+    int nearFace, farFace;
+    if (!slabs(r, tNear, nearFace, tFar, farFace)) return false;
+
+    // From outside the ray hits where it enters, from inside (like a ray refracted into glass) where it leaves.
+    if (tNear >= tMin && tNear <= tMax) {
+        rec.t = tNear;
+        rec.primitive = nearFace;
+    } else if (tFar >= tMin && tFar <= tMax) {
+        rec.t = tFar;
+        rec.primitive = farFace;
+    } else return false;
+
+    rec.object = this;
+    return true;
+}
+
+void Box::finishHit(const Ray& r, HitRecord& rec) const {
+    rec.p = r.at(rec.t);
+    int axis = rec.primitive / 2;
+    int uAxis = (axis + 1) % 3;
+    int vAxis = (axis + 2) % 3;
+    rec.u = (rec.p[uAxis] - boxMin[uAxis]) / (boxMax[uAxis] - boxMin[uAxis]);
+    rec.v = (rec.p[vAxis] - boxMin[vAxis]) / (boxMax[vAxis] - boxMin[vAxis]);
+    rec.setFaceNormal(r, faceNormal(rec.primitive));
+    rec.matPtr = matPtr;
+}
+
+double Box::pdfValue(const Point3& origin, const Vec3& direction) const {
+    double tNear, tFar;
+    int nearFace, farFace;
+    if (!slabs(Ray(origin, direction), tNear, nearFace, tFar, farFace)) return 0;
+
+    // random() picks points on all faces, so a direction is picked both through the point where it enters and the
+    //  one where it leaves the box.
+    double totalArea = area();
+    double pdf = 0;
+    if (tNear > 0.001) pdf += planarPdf(tNear, direction, faceNormal(nearFace), totalArea);
+    if (tFar > 0.001) pdf += planarPdf(tFar, direction, faceNormal(farFace), totalArea);
+    return pdf;
+}
+
+Vec3 Box::random(const Point3& origin) const {
+    // A face with probability proportional to its area, then a uniform point on it.
+    double pick = randomDouble(0, area() / 2);
+    int axis = 0;
+    while (axis < 2 && pick > faceArea(axis)) pick -= faceArea(axis++);
+
+    Point3 point;
+    point[axis] = randomDouble() < 0.5 ? boxMin[axis] : boxMax[axis];
+    for (int a = 1; a < 3; a++) {
+        int other = (axis + a) % 3;
+        point[other] = randomDouble(boxMin[other], boxMax[other]);
+    }
+    return point - origin;
+}
+
+#endif
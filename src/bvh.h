@@ -5,6 +5,7 @@
 #include "tracer.h"
 
 #include <algorithm>
+#include <chrono>
 #include "aabb.h"
 #include "corporeal.h"
 #include "corporealList.h"
@@ -14,8 +15,7 @@ class BvhNode : public Corporeal {
     public:
         BvhNode();
 
-        BvhNode(const CorporealList& list, double time0, double time1) 
-            : BvhNode(list.objects, 0, list.objects.size(), time0, time1) {}
+        BvhNode(const CorporealList& list, double time0, double time1);
 
         BvhNode(
             const std::vector<shared_ptr<Corporeal>>& sourceObjects, 
@@ -23,14 +23,32 @@ class BvhNode : public Corporeal {
 
         virtual bool hit(const Ray& r, double tMin, double tMax, HitRecord& rec) const override;
         virtual bool boundingBox(double time0, double time1, AABB& outputBox) const override;
+        virtual void hitPacket(const RayPacket& packet, uint32_t active, double tMin, PacketHits& hits) const override;
+
+        // The bounds of this node at a moment within the shutter interval.
+        AABB boxAt(double time) const;
 
     public:
         shared_ptr<Corporeal> left;
         shared_ptr<Corporeal> right;
+        // Bounds swept over the whole shutter interval.
         AABB box;
         AABB innerBox;
+        // Bounds at the moment the shutter opens and closes. Only differ from each other if something inside moves.
+        AABB boxStart;
+        AABB boxEnd;
+        double time0, time1;
+        bool moving;
+
+    private:
+        // Splits the objects between start and end into the two children, building subtrees as needed.
+        void build(const std::vector<shared_ptr<Corporeal>>& sourceObjects, size_t start, size_t end);
 };
 
+#ifdef BVH_REPORT
+void reportBvhBuild(const BvhNode& root, double buildMs);
+#endif
+
 inline bool boxCompare(const shared_ptr<Corporeal> a, const shared_ptr<Corporeal> b, int axis) {
     AABB boxA;
     AABB boxB;
@@ -53,11 +71,28 @@ bool boxZCompare (const shared_ptr<Corporeal> a, const shared_ptr<Corporeal> b)
     return boxCompare(a, b, 2);
 }
 
-// Optimize this bvh population
+// Builds a whole tree over the list. With BVH_REPORT defined the quality of every tree built is reported afterwards.
+BvhNode::BvhNode(const CorporealList& list, double time0, double time1) : time0(time0), time1(time1) {
+    #ifdef BVH_REPORT
+    auto buildStart = std::chrono::steady_clock::now();
+    #endif
+
+    build(list.objects, 0, list.objects.size());
+
+    #ifdef BVH_REPORT
+    reportBvhBuild(*this, std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - buildStart).count());
+    #endif
+}
+
 BvhNode::BvhNode(
     const std::vector<shared_ptr<Corporeal>>& sourceObjects, 
     size_t start, size_t end, double time0, double time1
-    ) {
+    ) : time0(time0), time1(time1) {
+    build(sourceObjects, start, end);
+}
+
+// Optimize this bvh population
+void BvhNode::build(const std::vector<shared_ptr<Corporeal>>& sourceObjects, size_t start, size_t end) {
     auto objects = sourceObjects; 
 
     int axis = randomInt(0,2);
@@ -86,26 +121,50 @@ BvhNode::BvhNode(
         right = make_shared<BvhNode>(objects, middle, end, time0, time1);
     }
 
-    AABB boxLeft, boxRight;
+    // Store the bounds at both ends of the shutter interval instead of one box swept over it. Moving objects 
+    //  would otherwise blow the swept box up to cover their whole path, which every ray then has to traverse.
+    AABB startLeft, startRight, endLeft, endRight;
 
-    if (!left->boundingBox(time0, time1, boxLeft) || !right->boundingBox(time0, time1, boxRight)) {
+    if (!left->boundingBox(time0, time0, startLeft) || !right->boundingBox(time0, time0, startRight)
+        || !left->boundingBox(time1, time1, endLeft) || !right->boundingBox(time1, time1, endRight)) {
         std::cerr << "Nou bounding box in BvhNode constructor. \n";
     }
 
-    box = surroundingBox(boxLeft, boxRight);
+    boxStart = surroundingBox(startLeft, startRight);
+    boxEnd = surroundingBox(endLeft, endRight);
+    moving = !(boxStart.min() == boxEnd.min() && boxStart.max() == boxEnd.max());
+
+    box = surroundingBox(boxStart, boxEnd);
     innerBox = frameBox(box, FRAME_THICKNESS);
-};
+}
 
 bool BvhNode::boundingBox(double time0, double time1, AABB& outputBox) const {
-    outputBox = box;
+    outputBox = moving ? surroundingBox(boxAt(time0), boxAt(time1)) : box;
     return true;
 }
 
+/**
+ * Linearly interpolates between the bounds at shutter open and close. Objects in this tree move linearly, and the
+ * interpolation of two boxes that each enclose all children also encloses each interpolated child, so the result is 
+ * conservative while staying as tight as the children at that moment.
+ */
+AABB BvhNode::boxAt(double time) const {
+    if (!moving || time1 == time0) return box;
+    auto s = clamp((time - time0) / (time1 - time0), 0.0, 1.0);
+    return AABB(
+        (1 - s) * boxStart.min() + s * boxEnd.min(),
+        (1 - s) * boxStart.max() + s * boxEnd.max()
+    );
+}
+
 /**
  * Check whether the box for this node is hit, and if so check the children for hits recursively.
  */
 bool BvhNode::hit(const Ray& r, double tMin, double tMax, HitRecord& rec) const {
-    if (!box.hit(r, tMin, tMax)) return false;
+    // Only nodes containing moving objects pay for the interpolation.
+    if (moving) {
+        if (!boxAt(r.time()).hit(r, tMin, tMax)) return false;
+    } else if (!box.hit(r, tMin, tMax)) return false;
 
     #ifdef WIREFRAME_MODE
     bool frameHit = !innerBox.hit(r, tMin, tMax);
@@ -127,4 +186,45 @@ bool BvhNode::hit(const Ray& r, double tMin, double tMax, HitRecord& rec) const
     return hitLeft || hitRight;
     #endif
 }
+
+/**
+ * Takes the rays of a packet down the tree together, so each node is fetched once for all of them. A node is first
+ * tested against the range the rays span, which can skip it for the whole packet in one go, and otherwise against
+ * every ray at once. Rays that miss drop out of the subtree, and once only a few are left they go on one at a time.
+ */
+void BvhNode::hitPacket(const RayPacket& packet, uint32_t active, double tMin, PacketHits& hits) const {
+    #ifdef WIREFRAME_MODE
+    // The frames are drawn by the single ray path.
+    Corporeal::hitPacket(packet, active, tMin, hits);
+    return;
+    #endif
+
+    if (moving) {
+        // Every ray has its own moment, and so its own box.
+        for (uint32_t lanes = active; lanes; lanes &= lanes - 1) {
+            int i = __builtin_ctz(lanes);
+            if (!boxAt(packet.rays[i].time()).hit(packet.rays[i], tMin, hits.tMax[i])) active &= ~(1u << i);
+        }
+    } else {
+        double farthest = 0;
+        for (uint32_t lanes = active; lanes; lanes &= lanes - 1) farthest = std::max(farthest, hits.tMax[__builtin_ctz(lanes)]);
+        if (box.missedByAll(packet, tMin, farthest)) return;
+        active = box.hit(packet, active, tMin, hits.tMax);
+    }
+    if (!active) return;
+
+    if (__builtin_popcount(active) < packetMinRays) {
+        // Not worth sharing any more.
+        left->Corporeal::hitPacket(packet, active, tMin, hits);
+        if (right != left) right->Corporeal::hitPacket(packet, active, tMin, hits);
+        return;
+    }
+    left->hitPacket(packet, active, tMin, hits);
+    if (right != left) right->hitPacket(packet, active, tMin, hits);
+}
+
+#ifdef BVH_REPORT
+#include "bvhReport.h"
+#endif
+
 #endif
\ No newline at end of file
@@ -0,0 +1,194 @@
+#ifndef BVH_REPORT_H
+#define BVH_REPORT_H
+
+#include "tracer.h"
+#include "aabb.h"
+#include "bvh.h"
+#include "flatBvh.h"
+
+#include <fstream>
+#include <iostream>
+#include <map>
+
+// Cost constants of the surface area heuristic. Only their ratio matters when comparing trees.
+const double sahTraversalCost = 1.0;
+const double sahIntersectionCost = 1.0;
+
+/**
+ * Numbers describing how good a built BVH is. All surface areas are relative to the root box, which makes them the
+ * probability of a random ray that hits the root also hitting that node.
+ */
+struct BvhReport {
+    // Expected cost of tracing a random ray through the tree according to the surface area heuristic.
+    double sahCost = 0;
+    int nodeCount = 0;
+    int leafCount = 0;
+    int primitiveCount = 0;
+    int maxLeafDepth = 0;
+    double averageLeafDepth = 0;
+    // Leaf size -> number of leaves with that many primitives.
+    std::map<int, int> leafSizes;
+    // Average share of a node's surface area taken up by the overlap of its two children. 0 is perfectly disjoint.
+    double siblingOverlap = 0;
+    int siblingPairs = 0;
+    size_t memoryBytes = 0;
+    double buildMs = 0;
+
+    void print(std::ostream& out) const;
+    void writeJson(std::ostream& out) const;
+};
+
+// Surface area of the overlap of two boxes, 0 if they don't overlap.
+double overlapArea(const AABB& a, const AABB& b) {
+    Point3 small(fmax(a.min().x(), b.min().x()), fmax(a.min().y(), b.min().y()), fmax(a.min().z(), b.min().z()));
+    Point3 big(fmin(a.max().x(), b.max().x()), fmin(a.max().y(), b.max().y()), fmin(a.max().z(), b.max().z()));
+    if (small.x() > big.x() || small.y() > big.y() || small.z() > big.z()) return 0.0;
+    return AABB(small, big).surfaceArea();
+}
+
+// Walks the tree below `node` and adds its numbers to the report. `rootArea` is the surface area of the tree's root.
+void collectBvhReport(const BvhNode& node, int depth, double rootArea, BvhReport& report) {
+    report.nodeCount++;
+    // make_shared puts the reference count right next to the node, count it as part of the node.
+    report.memoryBytes += sizeof(BvhNode) + 2 * sizeof(long);
+
+    double area = rootArea > 0 ? node.box.surfaceArea() / rootArea : 1.0;
+    report.sahCost += sahTraversalCost * area;
+
+    AABB boxLeft, boxRight;
+    node.left->boundingBox(node.time0, node.time1, boxLeft);
+    node.right->boundingBox(node.time0, node.time1, boxRight);
+    if (node.left != node.right) {
+        double nodeArea = node.box.surfaceArea();
+        report.siblingOverlap += nodeArea > 0 ? overlapArea(boxLeft, boxRight) / nodeArea : 0.0;
+        report.siblingPairs++;
+    }
+
+    // Children that are no BvhNode are primitives, which makes this node a leaf holding them.
+    int primitives = 0;
+    auto leftNode = dynamic_cast<const BvhNode*>(node.left.get());
+    auto rightNode = dynamic_cast<const BvhNode*>(node.right.get());
+    if (leftNode) collectBvhReport(*leftNode, depth + 1, rootArea, report);
+    else primitives++;
+    if (node.right != node.left) {
+        if (rightNode) collectBvhReport(*rightNode, depth + 1, rootArea, report);
+        else primitives++;
+    }
+
+    if (primitives > 0) {
+        report.leafCount++;
+        report.primitiveCount += primitives;
+        report.leafSizes[primitives]++;
+        report.averageLeafDepth += depth;
+        if (depth > report.maxLeafDepth) report.maxLeafDepth = depth;
+        report.sahCost += sahIntersectionCost * area * primitives;
+    }
+}
+
+BvhReport reportBvh(const BvhNode& root) {
+    BvhReport report;
+    collectBvhReport(root, 0, root.box.surfaceArea(), report);
+    if (report.leafCount > 0) report.averageLeafDepth /= report.leafCount;
+    if (report.siblingPairs > 0) report.siblingOverlap /= report.siblingPairs;
+    return report;
+}
+
+// Same walk for a FlatBvh, where leaves are marked by their primitive count instead of by their children's type.
+void collectFlatBvhReport(const FlatBvh& bvh, uint32_t nodeIndex, int depth, double rootArea, BvhReport& report) {
+    const FlatBvhNode& node = bvh.nodes[nodeIndex];
+    AABB box(Point3(node.min[0], node.min[1], node.min[2]), Point3(node.max[0], node.max[1], node.max[2]));
+    double area = rootArea > 0 ? box.surfaceArea() / rootArea : 1.0;
+
+    report.nodeCount++;
+    report.sahCost += sahTraversalCost * area;
+
+    if (node.count > 0) {
+        report.leafCount++;
+        report.primitiveCount += node.count;
+        report.leafSizes[node.count]++;
+        report.averageLeafDepth += depth;
+        if (depth > report.maxLeafDepth) report.maxLeafDepth = depth;
+        report.sahCost += sahIntersectionCost * area * node.count;
+        return;
+    }
+
+    const FlatBvhNode& left = bvh.nodes[node.offset];
+    const FlatBvhNode& right = bvh.nodes[node.offset + 1];
+    double nodeArea = box.surfaceArea();
+    if (nodeArea > 0) {
+        report.siblingOverlap += overlapArea(
+            AABB(Point3(left.min[0], left.min[1], left.min[2]), Point3(left.max[0], left.max[1], left.max[2])),
+            AABB(Point3(right.min[0], right.min[1], right.min[2]), Point3(right.max[0], right.max[1], right.max[2]))
+        ) / nodeArea;
+    }
+    report.siblingPairs++;
+
+    collectFlatBvhReport(bvh, node.offset, depth + 1, rootArea, report);
+    collectFlatBvhReport(bvh, node.offset + 1, depth + 1, rootArea, report);
+}
+
+BvhReport reportFlatBvh(const FlatBvh& bvh) {
+    BvhReport report;
+    if (bvh.empty()) return report;
+    collectFlatBvhReport(bvh, 0, 0, bvh.bounds().surfaceArea(), report);
+    if (report.leafCount > 0) report.averageLeafDepth /= report.leafCount;
+    if (report.siblingPairs > 0) report.siblingOverlap /= report.siblingPairs;
+    report.memoryBytes = bvh.memoryBytes();
+    return report;
+}
+
+void BvhReport::print(std::ostream& out) const {
+    out << "BVH report\n"
+        << "  SAH cost:          " << sahCost << "\n"
+        << "  nodes / leaves:    " << nodeCount << " / " << leafCount << "\n"
+        << "  primitives:        " << primitiveCount << "\n"
+        << "  leaf depth:        max " << maxLeafDepth << ", average " << averageLeafDepth << "\n"
+        << "  sibling overlap:   " << siblingOverlap * 100.0 << " %\n"
+        << "  memory:            " << memoryBytes / 1024.0 << " KiB\n"
+        << "  build time:        " << buildMs << " ms\n"
+        << "  leaf sizes:       ";
+    for (const auto& size : leafSizes) out << " " << size.first << ":" << size.second;
+    out << "\n";
+}
+
+// Writes the report as a single line JSON object, so consecutive builds can be appended to one file.
+void BvhReport::writeJson(std::ostream& out) const {
+    out << "{\"sahCost\": " << sahCost
+        << ", \"nodeCount\": " << nodeCount
+        << ", \"leafCount\": " << leafCount
+        << ", \"primitiveCount\": " << primitiveCount
+        << ", \"maxLeafDepth\": " << maxLeafDepth
+        << ", \"averageLeafDepth\": " << averageLeafDepth
+        << ", \"siblingOverlap\": " << siblingOverlap
+        << ", \"memoryBytes\": " << memoryBytes
+        << ", \"buildMs\": " << buildMs
+        << ", \"leafSizes\": {";
+    bool first = true;
+    for (const auto& size : leafSizes) {
+        out << (first ? "" : ", ") << "\"" << size.first << "\": " << size.second;
+        first = false;
+    }
+    out << "}}\n";
+}
+
+// Called by the BvhNode constructor after building a whole tree.
+void reportBvhBuild(const BvhNode& root, double buildMs) {
+    BvhReport report = reportBvh(root);
+    report.buildMs = buildMs;
+    report.print(std::cerr);
+
+    std::ofstream json(BVH_REPORT_FILE, std::ios::app);
+    report.writeJson(json);
+}
+
+// Called by FlatBvh::build after building a tree.
+void reportFlatBvhBuild(const FlatBvh& bvh, double buildMs) {
+    BvhReport report = reportFlatBvh(bvh);
+    report.buildMs = buildMs;
+    report.print(std::cerr);
+
+    std::ofstream json(BVH_REPORT_FILE, std::ios::app);
+    report.writeJson(json);
+}
+
+#endif
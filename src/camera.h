@@ -12,7 +12,9 @@ class Camera {
             double hFOV, // Horizontal field-of-view in degrees
             double aspectRatio,
             double aperture,
-            double focusDistance
+            double focusDistance,
+            double shutterOpen = 0.0, // Time at which the shutter opens
+            double shutterClose = 0.0 // Time at which the shutter closes
         ) {
             // h is the distance from viewport center to the left/right side of the viewport. TOA -> h = tan(hFOV[in rads] / 2)
             auto h = tan(degreesToRadians(hFOV) / 2);
@@ -33,13 +35,20 @@ class Camera {
             llCorner = origin - hor / 2 - ver / 2 - focusDistance * w;
 
             lensRadius = aperture / 2;
+            time0 = shutterOpen;
+            time1 = shutterClose;
         }
 
         Ray getRay(double s, double t) const {
             Vec3 rd = lensRadius * randomVectorInUnitDisk();
             Vec3 offset = u * rd.x() + v * rd.y();
 
-            return Ray(origin + offset, llCorner + s * hor + t * ver - origin - offset);
+            // Every ray gets a random moment within the shutter interval, averaging these over the samples gives motion blur.
+            return Ray(
+                origin + offset,
+                llCorner + s * hor + t * ver - origin - offset,
+                randomDouble(time0, time1)
+            );
         }
     private:
         Point3 origin;
@@ -48,6 +57,7 @@ class Camera {
         Vec3 ver;
         Vec3 u,v,w;
         double lensRadius;
+        double time0, time1;
 };
 
 #endif
\ No newline at end of file
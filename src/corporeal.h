@@ -2,10 +2,14 @@
 #define CORPOREAL_H
 
 #include "tracer.h"
+#include "rayPacket.h"
+
+#include <cstdint>
 
 // Declare the Material class to satisfy compiler as it's not defined here yet. 
 class Material;
 class AABB;
+class Corporeal;
 
 struct HitRecord {
     Point3 p;
@@ -17,6 +21,16 @@ struct HitRecord {
     double v;
     // Whether the ray intersects from the front/outside or back/inside
     bool frontFace;
+
+    // Hits are found in two steps: `hit` only records t and what it needs to find the spot again in these fields, and
+    // `finish` fills in everything above for the closest hit alone. Saves the UV math and material refcounting on all
+    // the hits that turn out to be behind another one. `object` is whoever still has to finish this record.
+    const Corporeal* object = nullptr;
+    uint32_t primitive;
+    double b1, b2;
+
+    inline void finish(const Ray& r);
+
     // The ray intersected from the front/outside if the normal points in the opposite direction.
     // If they are facing in the same direction the ray hit from the back/inside.
     // The directions are compared with the dot product, where <0 means front hit.
@@ -26,10 +40,45 @@ struct HitRecord {
     }
 };
 
+// The closest hit of every ray of a RayPacket so far. `tMax` starts at the far end of each ray's interval.
+struct PacketHits {
+    HitRecord rec[packetSize];
+    double tMax[packetSize];
+    // A bit for every ray with a hit in `rec`.
+    uint32_t hitMask = 0;
+};
+
 class Corporeal {
     public:
         virtual bool hit(const Ray& r, double tMin, double tMax, HitRecord& rec) const = 0;
         virtual bool boundingBox(double time0, double time1, AABB& outputBox) const = 0;
+        // Fills in p, normal, u, v and matPtr of a hit this object recorded. Only called for the closest one.
+        virtual void finishHit(const Ray& r, HitRecord& rec) const {}
+
+        // Intersects the rays of `packet` that have their bit set in `active`, keeping each one's closest hit in
+        //  `hits`. Objects that can share work between the rays override this, the rest trace them one by one.
+        virtual void hitPacket(const RayPacket& packet, uint32_t active, double tMin, PacketHits& hits) const {
+            while (active) {
+                int i = __builtin_ctz(active);
+                active &= active - 1;
+                if (hit(packet.rays[i], tMin, hits.tMax[i], hits.rec[i])) {
+                    hits.tMax[i] = hits.rec[i].t;
+                    hits.hitMask |= 1u << i;
+                }
+            }
+        }
+
+        // For sampling lights. The density over solid angle of picking `direction` from `origin` with random(), and a
+        //  random direction from `origin` towards a point on the surface. Objects that can't be sampled return 0.
+        virtual double pdfValue(const Point3& origin, const Vec3& direction) const { return 0.0; }
+        virtual Vec3 random(const Point3& origin) const { return Vec3(1, 0, 0); }
 };
 
+void HitRecord::finish(const Ray& r) {
+    if (!object) return;
+    const Corporeal* finisher = object;
+    object = nullptr;
+    finisher->finishHit(r, *this);
+}
+
 #endif
\ No newline at end of file
@@ -20,6 +20,9 @@ class CorporealList : public Corporeal {
 
         virtual bool hit(const Ray& r, double tMin, double tMax, HitRecord& rec) const override;
         virtual bool boundingBox(double time0, double time1, AABB& outputBox) const override;
+        virtual void hitPacket(const RayPacket& packet, uint32_t active, double tMin, PacketHits& hits) const override {
+            for (const auto& object : objects) object->hitPacket(packet, active, tMin, hits);
+        }
     public:
         std::vector<shared_ptr<Corporeal>> objects;
 };
@@ -0,0 +1,294 @@
+#ifndef CURVE_SET_H
+#define CURVE_SET_H
+
+#include "tracer.h"
+#include "corporeal.h"
+#include "aabb.h"
+#include "flatBvh.h"
+
+#include <cstdint>
+#include <vector>
+
+//// Cubic Bézier helpers, for curves given by four control points.
+
+inline Point3 lerpPoint(double t, const Point3& a, const Point3& b) { return (1 - t) * a + t * b; }
+
+// The point at `u` on the curve, and the tangent there if `derivative` is given.
+inline Point3 evalBezier(const Point3 cp[4], double u, Vec3* derivative = nullptr) {
+    Point3 a[3] = { lerpPoint(u, cp[0], cp[1]), lerpPoint(u, cp[1], cp[2]), lerpPoint(u, cp[2], cp[3]) };
+    Point3 b[2] = { lerpPoint(u, a[0], a[1]), lerpPoint(u, a[1], a[2]) };
+    if (derivative) {
+        // At the very ends the middle points can coincide with the end, the outer control points still give a direction.
+        if ((b[1] - b[0]).lengthSquared() > 0) *derivative = 3 * (b[1] - b[0]);
+        else *derivative = cp[3] - cp[0];
+    }
+    return lerpPoint(u, b[0], b[1]);
+}
+
+// The control points of the part of the curve between u0 and u1 (by blossoming).
+inline void subBezier(const Point3 cp[4], double u0, double u1, Point3 out[4]) {
+    auto blossom = [&cp](double s0, double s1, double s2) {
+        Point3 a[3] = { lerpPoint(s0, cp[0], cp[1]), lerpPoint(s0, cp[1], cp[2]), lerpPoint(s0, cp[2], cp[3]) };
+        Point3 b[2] = { lerpPoint(s1, a[0], a[1]), lerpPoint(s1, a[1], a[2]) };
+        return lerpPoint(s2, b[0], b[1]);
+    };
+    out[0] = blossom(u0, u0, u0);
+    out[1] = blossom(u0, u0, u1);
+    out[2] = blossom(u0, u1, u1);
+    out[3] = blossom(u1, u1, u1);
+}
+
+/**
+ * Everything about a ray the curve test needs. Curves are tested in a frame where the ray starts at the origin and
+ * runs down +z, so the test becomes whether the curve, seen flat in xy, passes within half its width of the origin.
+ */
+struct CurveRay {
+    CurveRay(const Ray& r) : origin(r.origin()) {
+        length = r.direction().length();
+        axisZ = r.direction() / length;
+        // Any two axes perpendicular to the ray will do.
+        Vec3 helper = fabs(axisZ.x()) > 0.9 ? Vec3(0, 1, 0) : Vec3(1, 0, 0);
+        axisX = unitVector(cross(helper, axisZ));
+        axisY = cross(axisZ, axisX);
+    }
+
+    Point3 toRaySpace(const Point3& p) const {
+        Vec3 d = p - origin;
+        return Point3(dot(d, axisX), dot(d, axisY), dot(d, axisZ));
+    }
+
+    Point3 origin;
+    Vec3 axisX, axisY, axisZ;
+    double length;
+};
+
+/**
+ * Hair, fur and grass: many cubic Bézier curves as a single object. A curve is a flat ribbon that always faces the
+ * ray, shaded as if it were a round tube. Width varies linearly from one end to the other.
+ *
+ * A single box around a long thin curve is mostly empty, and boxes of neighbouring hairs overlap a lot, which makes a
+ * BVH over them useless. So each curve is cut into segments that are nearly straight and get a tight box of their own,
+ * and the tree is built over those.
+ */
+class CurveSet : public Corporeal {
+    public:
+        CurveSet() {}
+        /**
+         * controlPoints: four per curve.
+         * widths:        two per curve, at its start and end.
+         * segments:      pieces to cut every curve into, 0 picks a count from the length and width of each curve.
+         */
+        CurveSet(const std::vector<Point3>& controlPoints, const std::vector<double>& widths, shared_ptr<Material> mat,
+            int segments = 0);
+
+        virtual bool hit(const Ray& r, double tMin, double tMax, HitRecord& rec) const override;
+        virtual bool boundingBox(double time0, double time1, AABB& outputBox) const override;
+        virtual void finishHit(const Ray& r, HitRecord& rec) const override;
+
+        size_t curveCount() const { return widths.size() / 2; }
+        size_t segmentCount() const { return segments.size(); }
+        size_t memoryBytes() const {
+            return controlPoints.size() * sizeof(Point3) + widths.size() * sizeof(double)
+                 + segments.size() * sizeof(Segment) + bvh.memoryBytes();
+        }
+
+    public:
+        struct Segment {
+            Point3 cp[4];
+            // Range of the whole curve this segment covers.
+            float u0, u1;
+            uint32_t curve;
+        };
+
+        FlatBvh bvh;
+        std::vector<Point3> controlPoints;
+        std::vector<double> widths;
+        // In BVH leaf order.
+        std::vector<Segment> segments;
+        shared_ptr<Material> matPtr;
+
+    private:
+        double width(uint32_t curve, double u) const { return (1 - u) * widths[2 * curve] + u * widths[2 * curve + 1]; }
+        bool hitSegment(const CurveRay& ray, const Segment& segment, double zMin, double& zMax, double& u, double& v) const;
+        bool hitRecursive(const Point3 cp[4], uint32_t curve, double u0, double u1, int depth, double zMin, double& zMax,
+            double& u, double& v) const;
+};
+
+CurveSet::CurveSet(const std::vector<Point3>& controlPoints, const std::vector<double>& widths, shared_ptr<Material> mat,
+    int segmentCount) : controlPoints(controlPoints), widths(widths), matPtr(mat) {
+    std::vector<Segment> pieces;
+    std::vector<AABB> bounds;
+    for (uint32_t curve = 0; curve < curveCount(); curve++) {
+        const Point3* cp = &controlPoints[4 * curve];
+        double maxWidth = fmax(widths[2 * curve], widths[2 * curve + 1]);
+        int count = segmentCount;
+        if (count <= 0) {
+            // Aim for segments a few widths long, past that the boxes are tight enough.
+            double hull = (cp[1] - cp[0]).length() + (cp[2] - cp[1]).length() + (cp[3] - cp[2]).length();
+            count = (int)clamp(ceil(hull / (8 * maxWidth)), 1, 16);
+        }
+        for (int i = 0; i < count; i++) {
+            Segment segment;
+            segment.u0 = (float)i / count;
+            segment.u1 = (float)(i + 1) / count;
+            segment.curve = curve;
+            subBezier(cp, segment.u0, segment.u1, segment.cp);
+
+            // The control points' hull contains the curve, grown by half the width.
+            double halfWidth = 0.5 * fmax(width(curve, segment.u0), width(curve, segment.u1));
+            Point3 low(infinity, infinity, infinity), high(-infinity, -infinity, -infinity);
+            for (int k = 0; k < 4; k++) {
+                for (int a = 0; a < 3; a++) {
+                    low[a] = fmin(low[a], segment.cp[k][a] - halfWidth);
+                    high[a] = fmax(high[a], segment.cp[k][a] + halfWidth);
+                }
+            }
+            pieces.push_back(segment);
+            bounds.push_back(AABB(low, high));
+        }
+    }
+
+    bvh.build(bounds);
+    segments.resize(pieces.size());
+    for (size_t slot = 0; slot < bvh.primIndices.size(); slot++) segments[slot] = pieces[bvh.primIndices[slot]];
+}
+
+bool CurveSet::boundingBox(double time0, double time1, AABB& outputBox) const {
+    if (bvh.empty()) return false;
+    outputBox = bvh.bounds();
+    return true;
+}
+
+bool CurveSet::hit(const Ray& r, double tMin, double tMax, HitRecord& rec) const {
+    CurveRay ray(r);
+    uint32_t closestSlot = 0;
+    double closestU = 0, closestV = 0;
+    double closestT = tMax;
+    bool hitAnything = bvh.hitLeaves(r, tMin, tMax,
+        [&](uint32_t first, uint32_t count, double tMin, double& closest) {
+        bool found = false;
+        for (uint32_t slot = first; slot < first + count; slot++) {
+            // The test works with distances along the ray, which are t scaled by the direction's length.
+            double zMax = closest * ray.length;
+            double u, v;
+            if (!hitSegment(ray, segments[slot], tMin * ray.length, zMax, u, v)) continue;
+            closest = closestT = zMax / ray.length;
+            closestSlot = slot;
+            closestU = u;
+            closestV = v;
+            found = true;
+        }
+        return found;
+    });
+    if (!hitAnything) return false;
+
+    rec.t = closestT;
+    rec.primitive = closestSlot;
+    rec.b1 = closestU;
+    rec.b2 = closestV;
+    rec.object = this;
+    return true;
+}
+
+bool CurveSet::hitSegment(const CurveRay& ray, const Segment& segment, double zMin, double& zMax, double& u, double& v) const {
+    Point3 cp[4];
+    for (int k = 0; k < 4; k++) cp[k] = ray.toRaySpace(segment.cp[k]);
+
+    // Split in halves until the pieces are flat to within a fraction of the width, then treat them as straight
+    //  (Nakamaru and Ohno). The depth follows from how far the control points bend away from a line.
+    double bend = 0;
+    for (int k = 0; k < 2; k++) {
+        Vec3 d = cp[k] - 2 * cp[k + 1] + cp[k + 2];
+        bend = fmax(bend, fmax(fabs(d.x()), fmax(fabs(d.y()), fabs(d.z()))));
+    }
+    double tolerance = fmax(width(segment.curve, segment.u0), width(segment.curve, segment.u1)) / 20;
+    double levels = log2(1.41421356237 * 6 * bend / (8 * tolerance)) / 2;
+    int depth = levels < 0 ? 0 : std::min((int)round(levels), 10);
+
+    return hitRecursive(cp, segment.curve, segment.u0, segment.u1, depth, zMin, zMax, u, v);
+}
+
+bool CurveSet::hitRecursive(const Point3 cp[4], uint32_t curve, double u0, double u1, int depth, double zMin, double& zMax,
+    double& u, double& v) const {
+    // Does the box of this piece, grown by half its width, contain the ray?
+    double halfWidth = 0.5 * fmax(width(curve, u0), width(curve, u1));
+    Point3 low(infinity, infinity, infinity), high(-infinity, -infinity, -infinity);
+    for (int k = 0; k < 4; k++) {
+        for (int a = 0; a < 3; a++) {
+            low[a] = fmin(low[a], cp[k][a]);
+            high[a] = fmax(high[a], cp[k][a]);
+        }
+    }
+    if (low.x() - halfWidth > 0 || high.x() + halfWidth < 0 || low.y() - halfWidth > 0 || high.y() + halfWidth < 0
+        || high.z() + halfWidth < zMin || low.z() - halfWidth > zMax) return false;
+
+    if (depth > 0) {
+        double uMid = 0.5 * (u0 + u1);
+        Point3 left[4], right[4];
+        subBezier(cp, 0, 0.5, left);
+        subBezier(cp, 0.5, 1, right);
+        // Both halves can be hit, the second one only counts if it's closer.
+        bool hitLeft = hitRecursive(left, curve, u0, uMid, depth - 1, zMin, zMax, u, v);
+        bool hitRight = hitRecursive(right, curve, uMid, u1, depth - 1, zMin, zMax, u, v);
+        return hitLeft || hitRight;
+    }
+
+    // Flat enough: reject if the ray passes beyond either end, where the next piece takes over.
+    double startEdge = (cp[1].y() - cp[0].y()) * -cp[0].y() + cp[0].x() * (cp[0].x() - cp[1].x());
+    if (startEdge < 0) return false;
+    double endEdge = (cp[2].y() - cp[3].y()) * -cp[3].y() + cp[3].x() * (cp[3].x() - cp[2].x());
+    if (endEdge < 0) return false;
+
+    // Closest point to the ray on the line through the ends.
+    double dx = cp[3].x() - cp[0].x(), dy = cp[3].y() - cp[0].y();
+    double denominator = dx * dx + dy * dy;
+    if (denominator == 0) return false;
+    double w = clamp((-cp[0].x() * dx - cp[0].y() * dy) / denominator, 0.0, 1.0);
+    double hitU = u0 + w * (u1 - u0);
+    double hitWidth = width(curve, hitU);
+
+    Vec3 tangent;
+    Point3 pc = evalBezier(cp, w, &tangent);
+    double distanceSquared = pc.x() * pc.x() + pc.y() * pc.y();
+    if (distanceSquared > 0.25 * hitWidth * hitWidth) return false;
+    if (pc.z() < zMin || pc.z() > zMax) return false;
+
+    zMax = pc.z();
+    u = hitU;
+    // Across the ribbon from 0 to 1, which side follows from the tangent.
+    double across = sqrt(distanceSquared) / hitWidth;
+    v = tangent.x() * -pc.y() + pc.x() * tangent.y() > 0 ? 0.5 + across : 0.5 - across;
+    return true;
+}
+
+void CurveSet::finishHit(const Ray& r, HitRecord& rec) const {
+    const Segment& segment = segments[rec.primitive];
+    rec.p = r.at(rec.t);
+    rec.u = rec.b1;
+    rec.v = rec.b2;
+    rec.matPtr = matPtr;
+
+    // Shade it as the tube it stands in for: lean the normal from facing the ray towards the side that was hit.
+    Vec3 tangent;
+    Point3 center = evalBezier(&controlPoints[4 * segment.curve], rec.u, &tangent);
+    tangent = unitVector(tangent);
+    Vec3 sideways = rec.p - center;
+    sideways -= dot(sideways, tangent) * tangent;
+    Vec3 facing = -r.direction();
+    facing -= dot(facing, tangent) * tangent;
+    if (facing.lengthSquared() == 0) {
+        // Looking straight down the curve.
+        rec.setFaceNormal(r, unitVector(-r.direction()));
+        return;
+    }
+    facing = unitVector(facing);
+    sideways -= dot(sideways, facing) * facing;
+
+    double radius = 0.5 * width(segment.curve, rec.u);
+    double offset = fmin(sideways.length() / radius, 1.0);
+    Vec3 normal = sqrt(1 - offset * offset) * facing;
+    if (offset > 0) normal += offset * unitVector(sideways);
+    rec.setFaceNormal(r, unitVector(normal));
+}
+
+#endif
@@ -0,0 +1,163 @@
+#ifndef DENSITY_GRID_H
+#define DENSITY_GRID_H
+
+#include "tracer.h"
+#include "aabb.h"
+
+#include <algorithm>
+#include <vector>
+
+/**
+ * A dense voxel grid of densities filling `bounds`. Values are stored at the voxel centres and interpolated
+ * trilinearly. Outside the grid the density is 0.
+ */
+class DensityGrid {
+    public:
+        DensityGrid() {}
+        // `values` holds nx * ny * nz densities, x changing fastest.
+        DensityGrid(int nx, int ny, int nz, const AABB& bounds, std::vector<float> values)
+            : bounds(bounds), values(std::move(values)) {
+            res[0] = nx; res[1] = ny; res[2] = nz;
+            voxelSize = Vec3((bounds.max().x() - bounds.min().x()) / nx,
+                             (bounds.max().y() - bounds.min().y()) / ny,
+                             (bounds.max().z() - bounds.min().z()) / nz);
+        }
+
+        // A voxel, indices outside the grid are clamped to its edge.
+        float voxel(int x, int y, int z) const {
+            x = std::min(std::max(x, 0), res[0] - 1);
+            y = std::min(std::max(y, 0), res[1] - 1);
+            z = std::min(std::max(z, 0), res[2] - 1);
+            return values[((size_t)z * res[1] + y) * res[0] + x];
+        }
+
+        double density(const Point3& p) const {
+            if (!bounds.contains(p)) return 0;
+            // Position in voxel units, relative to the centre of voxel 0.
+            double g[3];
+            int i[3];
+            for (int a = 0; a < 3; a++) {
+                g[a] = (p[a] - bounds.min()[a]) / voxelSize[a] - 0.5;
+                i[a] = (int)floor(g[a]);
+                g[a] -= i[a];
+            }
+            double result = 0;
+            for (int dz = 0; dz < 2; dz++)
+                for (int dy = 0; dy < 2; dy++)
+                    for (int dx = 0; dx < 2; dx++)
+                        result += (dx ? g[0] : 1 - g[0]) * (dy ? g[1] : 1 - g[1]) * (dz ? g[2] : 1 - g[2])
+                                * voxel(i[0] + dx, i[1] + dy, i[2] + dz);
+            return result;
+        }
+
+        size_t memoryBytes() const { return values.size() * sizeof(float); }
+
+    public:
+        AABB bounds;
+        int res[3] = { 0, 0, 0 };
+        Vec3 voxelSize;
+        std::vector<float> values;
+};
+
+/**
+ * The highest density in blocks of `blockSize`^3 voxels of a DensityGrid. Delta tracking needs a density that is never
+ * exceeded along a stretch of the ray. A single one for the whole grid makes rays take tiny steps through mostly empty
+ * space, the coarse grid lets them take big steps there and skip empty blocks outright.
+ */
+class MajorantGrid {
+    public:
+        MajorantGrid() {}
+        MajorantGrid(const DensityGrid& grid, int blockSize = 8) : bounds(grid.bounds) {
+            for (int a = 0; a < 3; a++) {
+                res[a] = (grid.res[a] + blockSize - 1) / blockSize;
+                cellSize[a] = grid.voxelSize[a] * blockSize;
+            }
+            majorants.assign((size_t)res[0] * res[1] * res[2], 0.0f);
+
+            for (int z = 0; z < res[2]; z++) {
+                for (int y = 0; y < res[1]; y++) {
+                    for (int x = 0; x < res[0]; x++) {
+                        // Interpolation inside the block also reads the voxels just around it.
+                        float highest = 0;
+                        for (int vz = z * blockSize - 1; vz <= (z + 1) * blockSize; vz++)
+                            for (int vy = y * blockSize - 1; vy <= (y + 1) * blockSize; vy++)
+                                for (int vx = x * blockSize - 1; vx <= (x + 1) * blockSize; vx++)
+                                    highest = std::max(highest, grid.voxel(vx, vy, vz));
+                        majorants[((size_t)z * res[1] + y) * res[0] + x] = highest;
+                    }
+                }
+            }
+        }
+
+        float majorant(int x, int y, int z) const { return majorants[((size_t)z * res[1] + y) * res[0] + x]; }
+
+        /**
+         * Walks the cells the ray passes between t0 and t1 in order and calls `visit(tEnter, tExit, majorant)` for
+         * each. Stops early when `visit` returns false.
+         */
+        template <typename Visitor>
+        void traverse(const Ray& r, double t0, double t1, Visitor visit) const;
+
+    public:
+        AABB bounds;
+        int res[3] = { 0, 0, 0 };
+        Vec3 cellSize;
+        std::vector<float> majorants;
+};
+
+/**
+ * Walks the cells of a regular grid that the ray passes between t0 and t1 in order (Amanatides & Woo). The grid has
+ * `res` cells of `cellSize` starting at `gridMin`. Calls `visit(cell, tEnter, tExit)` for each, stops early when it
+ * returns false. t0 must lie inside the grid.
+ */
+template <typename Visitor>
+void gridDda(const Ray& r, double t0, double t1, const Point3& gridMin, const Vec3& cellSize, const int res[3], Visitor visit) {
+    if (t0 >= t1) return;
+
+    Point3 start = r.at(t0);
+    int cell[3], step[3];
+    double tNext[3], tDelta[3];
+    for (int a = 0; a < 3; a++) {
+        cell[a] = std::min(std::max((int)floor((start[a] - gridMin[a]) / cellSize[a]), 0), res[a] - 1);
+        double direction = r.dir[a];
+        if (direction > 0) {
+            step[a] = 1;
+            tNext[a] = (gridMin[a] + (cell[a] + 1) * cellSize[a] - r.orig[a]) * r.invDir[a];
+            tDelta[a] = cellSize[a] * r.invDir[a];
+        } else if (direction < 0) {
+            step[a] = -1;
+            tNext[a] = (gridMin[a] + cell[a] * cellSize[a] - r.orig[a]) * r.invDir[a];
+            tDelta[a] = -cellSize[a] * r.invDir[a];
+        } else {
+            step[a] = 0;
+            tNext[a] = infinity;
+            tDelta[a] = infinity;
+        }
+    }
+
+    double tEnter = t0;
+    while (true) {
+        int axis = 0;
+        if (tNext[1] < tNext[axis]) axis = 1;
+        if (tNext[2] < tNext[axis]) axis = 2;
+        double tExit = std::min(tNext[axis], t1);
+
+        if (tExit > tEnter && !visit(cell, tEnter, tExit)) return;
+        if (tExit >= t1) return;
+
+        tEnter = tExit;
+        cell[axis] += step[axis];
+        if (cell[axis] < 0 || cell[axis] >= res[axis]) return;
+        tNext[axis] += tDelta[axis];
+    }
+}
+
+template <typename Visitor>
+void MajorantGrid::traverse(const Ray& r, double t0, double t1, Visitor visit) const {
+    if (majorants.empty()) return;
+    gridDda(r, t0, t1, bounds.min(), cellSize, res, [this, &visit](const int cell[3], double tEnter, double tExit) {
+        return visit(tEnter, tExit, (double)majorant(cell[0], cell[1], cell[2]));
+    });
+}
+
+#endif
@@ -0,0 +1,211 @@
+#ifndef DISPLACED_SURFACE_H
+#define DISPLACED_SURFACE_H
+
+#include "tracer.h"
+#include "corporeal.h"
+#include "aabb.h"
+#include "flatBvh.h"
+#include "texture.h"
+#include "triangleMesh.h"
+#include "geometryCache.h"
+
+#include <cstdint>
+#include <vector>
+
+// Uniform cubic B-spline weights of the four control points around `t`, and their derivatives.
+inline void bsplineWeights(double t, double w[4], double dw[4]) {
+    double s = 1 - t;
+    w[0] = s * s * s / 6;
+    w[1] = (3 * t * t * t - 6 * t * t + 4) / 6;
+    w[2] = (-3 * t * t * t + 3 * t * t + 3 * t + 1) / 6;
+    w[3] = t * t * t / 6;
+    dw[0] = -s * s / 2;
+    dw[1] = (3 * t * t - 4 * t) / 2;
+    dw[2] = (-3 * t * t + 2 * t + 1) / 2;
+    dw[3] = t * t / 2;
+}
+
+/**
+ * A smooth surface over a grid of control points (a uniform bicubic B-spline, which is what Catmull-Clark
+ * subdivision converges to on a regular quad mesh), pushed out along its normal by a displacement texture.
+ *
+ * Every 4x4 block of neighbouring control points makes a patch. Patches are only turned into triangles the first time
+ * a ray reaches their bounds, and the triangles go into a GeometryCache with a fixed budget. Evicted patches are
+ * tessellated again on their next use, so memory stays bounded however fine the tessellation.
+ *
+ * The displacement is `displacementScale` times the texture's red channel, clamped to [0, 1] so the patch bounds can
+ * account for it.
+ */
+class DisplacedSurface : public Corporeal {
+    public:
+        /**
+         * controlPoints: columns x rows points, a row at a time. Needs at least 4 in each direction. Seen from the
+         *                front, rows run to the right and later rows lie above earlier ones (counter clockwise, like
+         *                the triangles of a mesh).
+         * tessellation:  quads per patch side.
+         */
+        DisplacedSurface(std::vector<Point3> controlPoints, int columns, int rows, shared_ptr<Texture> displacement,
+            double displacementScale, int tessellation, shared_ptr<GeometryCache> cache, shared_ptr<Material> mat);
+
+        virtual bool hit(const Ray& r, double tMin, double tMax, HitRecord& rec) const override;
+        virtual bool boundingBox(double time0, double time1, AABB& outputBox) const override;
+        virtual void finishHit(const Ray& r, HitRecord& rec) const override;
+
+        int patchCount() const { return patchesU * patchesV; }
+        // The surface at (u, v) in patch units, so patch i covers u from i to i + 1. Optionally its normal as well.
+        Point3 surfacePoint(double u, double v, Vec3* normal = nullptr) const;
+        // The displaced surface at (u, v) in patch units.
+        Point3 displacedPoint(double u, double v) const;
+        // Tessellates a patch, this is what the cache calls on a miss.
+        shared_ptr<const TriangleMesh> tessellate(uint32_t patch) const;
+
+    public:
+        std::vector<Point3> controlPoints;
+        int columns, rows;
+        int patchesU, patchesV;
+        shared_ptr<Texture> displacement;
+        double displacementScale;
+        int tessellation;
+        shared_ptr<GeometryCache> cache;
+        shared_ptr<Material> matPtr;
+        // Over the patch bounds.
+        FlatBvh bvh;
+
+    private:
+        shared_ptr<const TriangleMesh> patchMesh(uint32_t patch) const {
+            return cache->get(GeometryKey{ this, patch }, [this, patch]() { return tessellate(patch); });
+        }
+};
+
+DisplacedSurface::DisplacedSurface(std::vector<Point3> controlPoints, int columns, int rows,
+    shared_ptr<Texture> displacement, double displacementScale, int tessellation, shared_ptr<GeometryCache> cache,
+    shared_ptr<Material> mat)
+    : controlPoints(std::move(controlPoints)), columns(columns), rows(rows), patchesU(columns - 3), patchesV(rows - 3),
+      displacement(displacement), displacementScale(displacementScale), tessellation(tessellation), cache(cache),
+      matPtr(mat) {
+    // A patch lies within the hull of its control points, but the B-spline ones reach over the neighbouring patches
+    //  as well, so the boxes would overlap a lot. The same patch written as a Bézier patch has control points that
+    //  hug it. The displacement can push it out by up to its scale.
+    const double toBezier[4][4] = { { 1, 4, 1, 0 }, { 0, 4, 2, 0 }, { 0, 2, 4, 0 }, { 0, 1, 4, 1 } };
+    double reach = fabs(displacementScale);
+    std::vector<AABB> bounds(patchCount());
+    for (int pv = 0; pv < patchesV; pv++) {
+        for (int pu = 0; pu < patchesU; pu++) {
+            Point3 low(infinity, infinity, infinity), high(-infinity, -infinity, -infinity);
+            for (int bj = 0; bj < 4; bj++) {
+                for (int bi = 0; bi < 4; bi++) {
+                    Point3 p;
+                    for (int j = 0; j < 4; j++)
+                        for (int i = 0; i < 4; i++)
+                            p += toBezier[bj][j] * toBezier[bi][i] / 36 * this->controlPoints[(pv + j) * columns + pu + i];
+                    for (int a = 0; a < 3; a++) {
+                        low[a] = fmin(low[a], p[a] - reach);
+                        high[a] = fmax(high[a], p[a] + reach);
+                    }
+                }
+            }
+            bounds[pv * patchesU + pu] = AABB(low, high);
+        }
+    }
+    bvh.build(bounds, 1);
+}
+
+bool DisplacedSurface::boundingBox(double time0, double time1, AABB& outputBox) const {
+    if (bvh.empty()) return false;
+    outputBox = bvh.bounds();
+    return true;
+}
+
+Point3 DisplacedSurface::surfacePoint(double u, double v, Vec3* normal) const {
+    // Points on the edge between two patches belong to the lower one, the far edges to the last patch.
+    int pu = std::min(std::max((int)floor(u), 0), patchesU - 1);
+    int pv = std::min(std::max((int)floor(v), 0), patchesV - 1);
+    double wu[4], dwu[4], wv[4], dwv[4];
+    bsplineWeights(u - pu, wu, dwu);
+    bsplineWeights(v - pv, wv, dwv);
+
+    Vec3 p, du, dv;
+    for (int j = 0; j < 4; j++) {
+        for (int i = 0; i < 4; i++) {
+            const Point3& c = controlPoints[(pv + j) * columns + pu + i];
+            p += wu[i] * wv[j] * c;
+            du += dwu[i] * wv[j] * c;
+            dv += wu[i] * dwv[j] * c;
+        }
+    }
+    if (normal) *normal = unitVector(cross(du, dv));
+    return p;
+}
+
+Point3 DisplacedSurface::displacedPoint(double u, double v) const {
+    Vec3 normal;
+    Point3 p = surfacePoint(u, v, &normal);
+    double amount = clamp(displacement->value(u / patchesU, v / patchesV, p).x(), 0.0, 1.0);
+    return p + displacementScale * amount * normal;
+}
+
+shared_ptr<const TriangleMesh> DisplacedSurface::tessellate(uint32_t patch) const {
+    const int n = tessellation;
+    const double pu = patch % patchesU, pv = patch / patchesU;
+    // A ring of extra points around the grid, so normals at the patch edges see the neighbouring patch and the
+    // shading is continuous across.
+    std::vector<Point3> grid((size_t)(n + 3) * (n + 3));
+    for (int j = -1; j <= n + 1; j++) {
+        for (int i = -1; i <= n + 1; i++) {
+            grid[(size_t)(j + 1) * (n + 3) + i + 1] = displacedPoint(pu + (double)i / n, pv + (double)j / n);
+        }
+    }
+    auto at = [&grid, n](int i, int j) -> const Point3& { return grid[(size_t)(j + 1) * (n + 3) + i + 1]; };
+
+    std::vector<float> positions, normals, uvs;
+    positions.reserve((size_t)(n + 1) * (n + 1) * 3);
+    normals.reserve((size_t)(n + 1) * (n + 1) * 3);
+    uvs.reserve((size_t)(n + 1) * (n + 1) * 2);
+    for (int j = 0; j <= n; j++) {
+        for (int i = 0; i <= n; i++) {
+            const Point3& p = at(i, j);
+            Vec3 normal = unitVector(cross(at(i + 1, j) - at(i - 1, j), at(i, j + 1) - at(i, j - 1)));
+            for (int a = 0; a < 3; a++) {
+                positions.push_back((float)p[a]);
+                normals.push_back((float)normal[a]);
+            }
+            uvs.push_back((float)((pu + (double)i / n) / patchesU));
+            uvs.push_back((float)((pv + (double)j / n) / patchesV));
+        }
+    }
+
+    std::vector<uint32_t> indices;
+    indices.reserve((size_t)n * n * 6);
+    for (int j = 0; j < n; j++) {
+        for (int i = 0; i < n; i++) {
+            uint32_t v00 = j * (n + 1) + i, v10 = v00 + 1, v01 = v00 + n + 1, v11 = v01 + 1;
+            uint32_t quad[6] = { v00, v10, v11, v00, v11, v01 };
+            indices.insert(indices.end(), quad, quad + 6);
+        }
+    }
+
+    return make_shared<TriangleMesh>(std::move(positions), std::move(indices), matPtr, std::move(normals), std::move(uvs));
+}
+
+bool DisplacedSurface::hit(const Ray& r, double tMin, double tMax, HitRecord& rec) const {
+    const uint32_t trianglesPerPatch = 2 * tessellation * tessellation;
+    return bvh.hit(r, tMin, tMax, [this, &r, &rec, trianglesPerPatch](uint32_t patch, double tMin, double& closest) {
+        // Only now does the patch need triangles.
+        shared_ptr<const TriangleMesh> mesh = patchMesh(patch);
+        if (!mesh->hit(r, tMin, closest, rec)) return false;
+        closest = rec.t;
+        // The mesh may be evicted before the hit is finished, remember where to find the triangle again instead.
+        rec.primitive = patch * trianglesPerPatch + rec.primitive;
+        rec.object = this;
+        return true;
+    });
+}
+
+void DisplacedSurface::finishHit(const Ray& r, HitRecord& rec) const {
+    const uint32_t trianglesPerPatch = 2 * tessellation * tessellation;
+    // Tessellation is deterministic, so a patch built again has the same triangles.
+    shared_ptr<const TriangleMesh> mesh = patchMesh(rec.primitive / trianglesPerPatch);
+    mesh->fillHit(rec.primitive % trianglesPerPatch, r, rec.t, 1.0 - rec.b1 - rec.b2, rec.b1, rec.b2, rec);
+}
+
+#endif
@@ -0,0 +1,101 @@
+// Checks the approximations in fastMath.h against libm, over the input ranges and to the error bounds documented
+//  there. Prints the largest error of each and exits with 1 if any bound is broken.
+//
+//     g++ -std=c++11 -O2 src/fastMathCheck.cpp -o fastMathCheck && ./fastMathCheck
+
+#include "tracer.h"
+#include "fastMath.h"
+
+#include <iostream>
+
+int failures = 0;
+
+void check(const char* name, double error, double bound) {
+    std::cout << name << ": largest error " << error << " (bound " << bound << ")\n";
+    if (!(error < bound)) {
+        std::cerr << "ERROR: " << name << " is off by " << error << ", more than " << bound << ".\n";
+        failures++;
+    }
+}
+
+// Same value including the sign of zero, for the cases that have to match exactly.
+void checkExactly(const char* name, double value, double expected) {
+    if (value != expected || std::signbit(value) != std::signbit(expected)) {
+        std::cerr << "ERROR: " << name << " is " << value << " instead of " << expected << ".\n";
+        failures++;
+    }
+}
+
+int main() {
+    const int samples = 1000000;
+
+    double acosError = 0;
+    for (int i = 0; i <= samples; i++) {
+        double x = -1 + 2.0 * i / samples;
+        acosError = fmax(acosError, fabs(acosApprox<fastMath>(x) - acos(x)));
+    }
+    check("acos on [-1, 1]", acosError, 7e-5);
+
+    double atan2Error = 0;
+    for (int i = 0; i < samples; i++) {
+        // Around the whole circle at radii over many orders of magnitude.
+        double angle = -pi + 2 * pi * randomDouble();
+        double radius = pow(10.0, randomDouble(-30, 30));
+        double y = radius * sin(angle), x = radius * cos(angle);
+        atan2Error = fmax(atan2Error, fabs(atan2Approx<fastMath>(y, x) - atan2(y, x)));
+    }
+    const double axes[][2] = { { 0, 1 }, { 1, 0 }, { 0, -1 }, { -1, 0 }, { 1, 1 }, { -1, -1 }, { 1, -1 }, { -1, 1 } };
+    for (const auto& a : axes) atan2Error = fmax(atan2Error, fabs(atan2Approx<fastMath>(a[0], a[1]) - atan2(a[0], a[1])));
+    check("atan2", atan2Error, 2e-6);
+    const double zero = 0.0;
+    const double zeros[][2] = { { zero, zero }, { zero, -zero }, { -zero, zero }, { -zero, -zero }, { zero, -1 },
+                                { -zero, -1 }, { zero, 1 }, { -zero, 1 }, { 1, -zero }, { -1, -zero } };
+    for (const auto& z : zeros) checkExactly("atan2 of a signed zero", atan2Approx<fastMath>(z[0], z[1]), atan2(z[0], z[1]));
+
+    double sinError = 0;
+    for (int i = 0; i <= samples; i++) {
+        double x = -1e4 + 2e4 * i / samples;
+        sinError = fmax(sinError, fabs(sinApprox<fastMath>(x) - sin(x)));
+    }
+    check("sin on [-1e4, 1e4]", sinError, 4e-6);
+
+    double powError = 0;
+    for (int i = 0; i < samples; i++) {
+        double x = pow(10.0, randomDouble(-100, 100));
+        double y = randomDouble(-3, 3);
+        double exact = pow(x, y);
+        // Only where the result is a normal double.
+        if (exact < 1e-300 || exact > 1e300) continue;
+        powError = fmax(powError, fabs(powApprox<fastMath>(x, y) - exact) / exact);
+    }
+    // The range shading uses it in: gamma correction of colours in [0, 1].
+    for (int i = 1; i <= samples; i++) {
+        double x = (double)i / samples;
+        powError = fmax(powError, fabs(powApprox<fastMath>(x, 1 / 2.2) - pow(x, 1 / 2.2)) / pow(x, 1 / 2.2));
+    }
+    check("pow, relative", powError, 1e-6);
+    checkExactly("pow of 0", powApprox<fastMath>(0, 2.2), 0);
+
+    double pow5Error = 0;
+    for (int i = 0; i <= samples; i++) {
+        double x = -2 + 4.0 * i / samples;
+        pow5Error = fmax(pow5Error, fabs(pow5(x) - pow(x, 5)) / fmax(fabs(pow(x, 5)), 1e-300));
+    }
+    check("pow5, relative", pow5Error, 1e-15);
+
+    // The exact variants have to be libm itself.
+    for (int i = 0; i < 1000; i++) {
+        double x = randomDouble(-1, 1), y = randomDouble(-1, 1);
+        checkExactly("exact acos", acosApprox<exactMath>(x), acos(x));
+        checkExactly("exact atan2", atan2Approx<exactMath>(y, x), atan2(y, x));
+        checkExactly("exact sin", sinApprox<exactMath>(100 * x), sin(100 * x));
+        checkExactly("exact pow", powApprox<exactMath>(fabs(x), 2 * y), pow(fabs(x), 2 * y));
+    }
+
+    if (failures > 0) {
+        std::cerr << "ERROR: " << failures << " checks failed.\n";
+        return 1;
+    }
+    std::cout << "All checks passed.\n";
+    return 0;
+}
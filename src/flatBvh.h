@@ -0,0 +1,232 @@
+#ifndef FLAT_BVH_H
+#define FLAT_BVH_H
+
+#include "tracer.h"
+#include "aabb.h"
+#include "meshBuffer.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <vector>
+
+/**
+ * Node of a FlatBvh. Interior nodes point to their first child, the second child is always stored right after it.
+ * Leaves point to a range in the primitive index list. Bounds are floats so a node fits in 32 bytes.
+ */
+struct FlatBvhNode {
+    float min[3];
+    float max[3];
+    // Interior: index of the left child. Leaf: first entry in `primIndices`.
+    uint32_t offset;
+    // Number of primitives in a leaf, 0 for interior nodes.
+    uint16_t count;
+    // Axis the node was split on, used to visit the nearest child first.
+    uint16_t axis;
+};
+
+/**
+ * A BVH over primitives that are only known by their index, for primitives that live in shared arrays instead of
+ * being separate Corporeal objects (like the triangles of a mesh). Nodes are stored in one contiguous array and
+ * traversal runs on a small stack instead of recursing through virtual `hit` calls.
+ */
+class FlatBvh {
+    public:
+        static const int maxLeafSize = 4;
+
+        FlatBvh() {}
+
+        /**
+         * Builds the tree over primitives 0..bounds.size()-1 using their bounding boxes. Leaves get at most
+         * `leafSize` primitives, pick it to match how many the caller tests at once.
+         */
+        void build(const std::vector<AABB>& bounds, uint32_t leafSize = maxLeafSize);
+
+        /**
+         * Traverses the tree and calls `hitPrimitive(index, tMin, closest)` for every primitive in a leaf the ray
+         * reaches. It must return true and shrink `closest` if it found a closer hit.
+         */
+        template <typename HitFunction>
+        bool hit(const Ray& r, double tMin, double tMax, HitFunction hitPrimitive) const;
+
+        /**
+         * Same traversal, but calls `hitLeaf(first, count, tMin, closest)` once per leaf with the range of entries
+         * in `primIndices` it holds. For primitives that are laid out in leaf order and tested a whole leaf at once.
+         */
+        template <typename LeafFunction>
+        bool hitLeaves(const Ray& r, double tMin, double tMax, LeafFunction hitLeaf) const;
+
+        bool empty() const { return nodes.empty(); }
+        AABB bounds() const {
+            if (nodes.empty()) return AABB();
+            return AABB(Point3(nodes[0].min[0], nodes[0].min[1], nodes[0].min[2]),
+                        Point3(nodes[0].max[0], nodes[0].max[1], nodes[0].max[2]));
+        }
+        size_t memoryBytes() const {
+            return nodes.ownedBytes() + primIndices.ownedBytes();
+        }
+
+    public:
+        // Buffers instead of vectors, so a tree can also be used straight out of a mapped cache file.
+        MeshBuffer<FlatBvhNode> nodes;
+        // Primitive indices in leaf order.
+        MeshBuffer<uint32_t> primIndices;
+
+    private:
+        static void buildRecursive(uint32_t nodeIndex, uint32_t start, uint32_t end, uint32_t leafSize,
+            const std::vector<AABB>& bounds, const std::vector<Point3>& centroids,
+            std::vector<FlatBvhNode>& nodes, std::vector<uint32_t>& primIndices);
+};
+
+#ifdef BVH_REPORT
+void reportFlatBvhBuild(const FlatBvh& bvh, double buildMs);
+#endif
+
+void FlatBvh::build(const std::vector<AABB>& bounds, uint32_t leafSize) {
+    #ifdef BVH_REPORT
+    auto buildStart = std::chrono::steady_clock::now();
+    #endif
+
+    std::vector<FlatBvhNode> nodes;
+    std::vector<uint32_t> primIndices(bounds.size());
+    this->nodes = MeshBuffer<FlatBvhNode>();
+    this->primIndices = MeshBuffer<uint32_t>();
+    if (bounds.empty()) return;
+
+    std::vector<Point3> centroids(bounds.size());
+    for (size_t i = 0; i < bounds.size(); i++) {
+        primIndices[i] = (uint32_t)i;
+        centroids[i] = 0.5 * (bounds[i].min() + bounds[i].max());
+    }
+
+    // A binary tree with leaves of at least one primitive never has more than 2n - 1 nodes.
+    nodes.reserve(2 * bounds.size());
+    nodes.push_back(FlatBvhNode());
+    buildRecursive(0, 0, (uint32_t)bounds.size(), leafSize, bounds, centroids, nodes, primIndices);
+    nodes.shrink_to_fit();
+    this->nodes = std::move(nodes);
+    this->primIndices = std::move(primIndices);
+
+    #ifdef BVH_REPORT
+    reportFlatBvhBuild(*this, std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - buildStart).count());
+    #endif
+}
+
+void FlatBvh::buildRecursive(uint32_t nodeIndex, uint32_t start, uint32_t end, uint32_t leafSize,
+    const std::vector<AABB>& bounds, const std::vector<Point3>& centroids,
+    std::vector<FlatBvhNode>& nodes, std::vector<uint32_t>& primIndices) {
+    // Bounds of everything in this node, and of the centroids to pick the split axis from.
+    AABB box = bounds[primIndices[start]];
+    Point3 centroidMin = centroids[primIndices[start]];
+    Point3 centroidMax = centroidMin;
+    for (uint32_t i = start + 1; i < end; i++) {
+        box = surroundingBox(box, bounds[primIndices[i]]);
+        const Point3& c = centroids[primIndices[i]];
+        for (int a = 0; a < 3; a++) {
+            centroidMin[a] = fmin(centroidMin[a], c[a]);
+            centroidMax[a] = fmax(centroidMax[a], c[a]);
+        }
+    }
+
+    FlatBvhNode& node = nodes[nodeIndex];
+    for (int a = 0; a < 3; a++) {
+        // Round outwards so the float box never ends up inside the double one.
+        node.min[a] = std::nextafter((float)box.min()[a], -std::numeric_limits<float>::infinity());
+        node.max[a] = std::nextafter((float)box.max()[a], std::numeric_limits<float>::infinity());
+    }
+
+    Vec3 extent = centroidMax - centroidMin;
+    int axis = 0;
+    if (extent.y() > extent[axis]) axis = 1;
+    if (extent.z() > extent[axis]) axis = 2;
+
+    if (end - start <= leafSize) {
+        node.offset = start;
+        node.count = (uint16_t)(end - start);
+        node.axis = 0;
+        return;
+    }
+
+    // Split at the median along the longest axis of the centroids. If they all sit on the same spot this still halves 
+    //  the list, so leaves never grow past leafSize.
+    uint32_t middle = start + (end - start) / 2;
+    std::nth_element(primIndices.begin() + start, primIndices.begin() + middle, primIndices.begin() + end,
+        [&centroids, axis](uint32_t a, uint32_t b) { return centroids[a][axis] < centroids[b][axis]; });
+
+    uint32_t leftIndex = (uint32_t)nodes.size();
+    node.offset = leftIndex;
+    node.count = 0;
+    node.axis = (uint16_t)axis;
+    // Both children are added next to each other. Don't touch `node` after this, push_back may move it.
+    nodes.push_back(FlatBvhNode());
+    nodes.push_back(FlatBvhNode());
+    buildRecursive(leftIndex, start, middle, leafSize, bounds, centroids, nodes, primIndices);
+    buildRecursive(leftIndex + 1, middle, end, leafSize, bounds, centroids, nodes, primIndices);
+}
+
+template <typename HitFunction>
+bool FlatBvh::hit(const Ray& r, double tMin, double tMax, HitFunction hitPrimitive) const {
+    return hitLeaves(r, tMin, tMax, [this, &hitPrimitive](uint32_t first, uint32_t count, double tMin, double& closest) {
+        bool hitAnything = false;
+        for (uint32_t i = first; i < first + count; i++) {
+            if (hitPrimitive(primIndices[i], tMin, closest)) hitAnything = true;
+        }
+        return hitAnything;
+    });
+}
+
+template <typename LeafFunction>
+bool FlatBvh::hitLeaves(const Ray& r, double tMin, double tMax, LeafFunction hitLeaf) const {
+    if (nodes.empty()) return false;
+
+    // The ray has the slab test terms ready.
+    const Point3& origin = r.orig;
+    const Vec3& invDir = r.invDir;
+    const bool* dirNegative = r.dirNegative;
+
+    bool hitAnything = false;
+    double closest = tMax;
+    uint32_t stack[64];
+    int stackSize = 0;
+    uint32_t current = 0;
+
+    while (true) {
+        const FlatBvhNode& node = nodes[current];
+
+        double t0 = tMin;
+        double t1 = closest;
+        for (int a = 0; a < 3; a++) {
+            double tNear = ((dirNegative[a] ? node.max[a] : node.min[a]) - origin[a]) * invDir[a];
+            double tFar  = ((dirNegative[a] ? node.min[a] : node.max[a]) - origin[a]) * invDir[a];
+            t0 = tNear > t0 ? tNear : t0;
+            t1 = tFar < t1 ? tFar : t1;
+        }
+
+        if (t0 <= t1) {
+            if (node.count > 0) {
+                if (hitLeaf(node.offset, node.count, tMin, closest)) hitAnything = true;
+            } else {
+                // Visit the child on the side the ray comes from first, so `closest` shrinks as early as possible.
+                if (dirNegative[node.axis]) {
+                    stack[stackSize++] = node.offset;
+                    current = node.offset + 1;
+                } else {
+                    stack[stackSize++] = node.offset + 1;
+                    current = node.offset;
+                }
+                continue;
+            }
+        }
+
+        if (stackSize == 0) break;
+        current = stack[--stackSize];
+    }
+
+    return hitAnything;
+}
+
+#ifdef BVH_REPORT
+#include "bvhReport.h"
+#endif
+
+#endif
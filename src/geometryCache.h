@@ -0,0 +1,132 @@
+#ifndef GEOMETRY_CACHE_H
+#define GEOMETRY_CACHE_H
+
+#include "tracer.h"
+#include "triangleMesh.h"
+
+#include <cstdint>
+#include <functional>
+#include <list>
+#include <mutex>
+#include <unordered_map>
+
+// Identifies a piece of geometry: whose it is, and which of its pieces.
+struct GeometryKey {
+    const void* owner;
+    uint32_t index;
+};
+
+struct GeometryKeyHash {
+    size_t operator()(const GeometryKey& key) const {
+        return std::hash<const void*>()(key.owner) ^ (std::hash<uint32_t>()(key.index) * 0x9e3779b97f4a7c15ull);
+    }
+};
+
+struct GeometryKeyEqual {
+    bool operator()(const GeometryKey& a, const GeometryKey& b) const { return a.owner == b.owner && a.index == b.index; }
+};
+
+/**
+ * Meshes that can be rebuilt at any time (like tessellated patches), kept within a memory budget. When adding one
+ * would go over the budget, the least recently used ones are dropped and will be built again when they're needed.
+ *
+ * One cache is shared by all render threads. Every lookup touches the recency list, so the cache is split into shards
+ * by key, each with its own lock and share of the budget, to keep threads from queueing on a single mutex. Entries are
+ * handed out as shared_ptrs, so a mesh a thread is still intersecting stays alive after it is evicted. Building
+ * happens outside the lock: two threads that miss the same entry at the same time both build it and the second copy
+ * is thrown away, which is cheaper than having every thread wait for one build.
+ */
+class GeometryCache {
+    public:
+        static const int shardCount = 16;
+
+        GeometryCache(size_t budgetBytes) : budgetBytes(budgetBytes) {}
+
+        /**
+         * The mesh for `key`, built with `build()` if it isn't cached. `extraBytes` is memory the mesh keeps in use
+         * without owning it (like pages of a mapped file), counted against the budget as well.
+         */
+        template <typename Builder>
+        shared_ptr<const TriangleMesh> get(const GeometryKey& key, Builder build, size_t extraBytes = 0);
+
+        size_t bytesUsed() const { return sum(&Shard::usedBytes); }
+        size_t entryCount() const { return sum(&Shard::entryCount); }
+        uint64_t hitCount() const { return sum(&Shard::hits); }
+        uint64_t buildCount() const { return sum(&Shard::builds); }
+        uint64_t evictionCount() const { return sum(&Shard::evictions); }
+
+    public:
+        const size_t budgetBytes;
+
+    private:
+        struct Entry {
+            GeometryKey key;
+            shared_ptr<const TriangleMesh> mesh;
+            size_t bytes;
+        };
+
+        struct Shard {
+            std::mutex mutex;
+            // Most recently used at the front.
+            std::list<Entry> entries;
+            std::unordered_map<GeometryKey, std::list<Entry>::iterator, GeometryKeyHash, GeometryKeyEqual> lookup;
+            size_t usedBytes = 0;
+            size_t entryCount = 0;
+            uint64_t hits = 0;
+            uint64_t builds = 0;
+            uint64_t evictions = 0;
+        };
+
+        mutable Shard shards[shardCount];
+
+        template <typename T>
+        T sum(T Shard::* counter) const {
+            T total = 0;
+            for (int i = 0; i < shardCount; i++) {
+                std::lock_guard<std::mutex> lock(shards[i].mutex);
+                total += shards[i].*counter;
+            }
+            return total;
+        }
+};
+
+template <typename Builder>
+shared_ptr<const TriangleMesh> GeometryCache::get(const GeometryKey& key, Builder build, size_t extraBytes) {
+    Shard& shard = shards[GeometryKeyHash()(key) % shardCount];
+    {
+        std::lock_guard<std::mutex> lock(shard.mutex);
+        auto found = shard.lookup.find(key);
+        if (found != shard.lookup.end()) {
+            shard.hits++;
+            shard.entries.splice(shard.entries.begin(), shard.entries, found->second);
+            return found->second->mesh;
+        }
+    }
+
+    shared_ptr<const TriangleMesh> mesh = build();
+    size_t bytes = mesh->memoryBytes() + extraBytes;
+
+    std::lock_guard<std::mutex> lock(shard.mutex);
+    shard.builds++;
+    auto found = shard.lookup.find(key);
+    if (found != shard.lookup.end()) {
+        // Another thread got there first.
+        shard.entries.splice(shard.entries.begin(), shard.entries, found->second);
+        return found->second->mesh;
+    }
+    shard.entries.push_front(Entry{ key, mesh, bytes });
+    shard.lookup[key] = shard.entries.begin();
+    shard.usedBytes += bytes;
+    shard.entryCount++;
+    // Never evict the entry just added, a single mesh over the budget still has to be usable.
+    while (shard.usedBytes > budgetBytes / shardCount && shard.entryCount > 1) {
+        shard.usedBytes -= shard.entries.back().bytes;
+        shard.lookup.erase(shard.entries.back().key);
+        shard.entries.pop_back();
+        shard.entryCount--;
+        shard.evictions++;
+    }
+    return mesh;
+}
+
+#endif
@@ -0,0 +1,258 @@
+#ifndef IMPLICIT_SURFACE_H
+#define IMPLICIT_SURFACE_H
+
+#include "tracer.h"
+#include "corporeal.h"
+#include "aabb.h"
+
+/**
+ * A signed distance field: negative inside the shape, positive outside. Its magnitude may underestimate the distance
+ * to the surface but never overestimate it by more than the Lipschitz bound, so stepping distance / lipschitz along a
+ * ray can't skip the surface.
+ */
+class DistanceField {
+    public:
+        virtual double distance(const Point3& p) const = 0;
+        // Points away from the inside. Central differences unless a field knows better.
+        virtual Vec3 gradient(const Point3& p) const {
+            const double h = 1e-5;
+            return Vec3(
+                distance(p + Vec3(h, 0, 0)) - distance(p - Vec3(h, 0, 0)),
+                distance(p + Vec3(0, h, 0)) - distance(p - Vec3(0, h, 0)),
+                distance(p + Vec3(0, 0, h)) - distance(p - Vec3(0, 0, h)));
+        }
+        // A box around everything with distance <= 0.
+        virtual AABB bounds() const = 0;
+        // How much faster than the true distance the field can change, 1 for exact distances.
+        virtual double lipschitz() const { return 1.0; }
+};
+
+class SdfSphere : public DistanceField {
+    public:
+        SdfSphere(Point3 center, double radius) : center(center), radius(radius) {}
+
+        virtual double distance(const Point3& p) const override { return (p - center).length() - radius; }
+        virtual Vec3 gradient(const Point3& p) const override { return p - center; }
+        virtual AABB bounds() const override {
+            return AABB(center - Vec3(radius, radius, radius), center + Vec3(radius, radius, radius));
+        }
+
+    public:
+        Point3 center;
+        double radius;
+};
+
+// A ring lying flat (in the XZ plane) around `center`.
+class SdfTorus : public DistanceField {
+    public:
+        SdfTorus(Point3 center, double majorRadius, double minorRadius)
+            : center(center), majorRadius(majorRadius), minorRadius(minorRadius) {}
+
+        virtual double distance(const Point3& p) const override {
+            Vec3 d = p - center;
+            double ring = sqrt(d.x() * d.x() + d.z() * d.z()) - majorRadius;
+            return sqrt(ring * ring + d.y() * d.y()) - minorRadius;
+        }
+        virtual Vec3 gradient(const Point3& p) const override {
+            Vec3 d = p - center;
+            double radial = sqrt(d.x() * d.x() + d.z() * d.z());
+            if (radial == 0) return Vec3(0, d.y(), 0);
+            double ring = radial - majorRadius;
+            return Vec3(d.x() / radial * ring, d.y(), d.z() / radial * ring);
+        }
+        virtual AABB bounds() const override {
+            double outer = majorRadius + minorRadius;
+            return AABB(center - Vec3(outer, minorRadius, outer), center + Vec3(outer, minorRadius, outer));
+        }
+
+    public:
+        Point3 center;
+        double majorRadius;
+        double minorRadius;
+};
+
+// A box with edges rounded off by `rounding`, which has to be smaller than every half extent.
+class SdfRoundBox : public DistanceField {
+    public:
+        SdfRoundBox(Point3 center, Vec3 halfExtents, double rounding)
+            : center(center), halfExtents(halfExtents), rounding(rounding) {}
+
+        virtual double distance(const Point3& p) const override {
+            Vec3 q = excess(p);
+            Vec3 outside(fmax(q.x(), 0.0), fmax(q.y(), 0.0), fmax(q.z(), 0.0));
+            return outside.length() + fmin(fmax(q.x(), fmax(q.y(), q.z())), 0.0) - rounding;
+        }
+        virtual Vec3 gradient(const Point3& p) const override {
+            Vec3 d = p - center;
+            Vec3 q = excess(p);
+            Vec3 g;
+            if (q.x() > 0 || q.y() > 0 || q.z() > 0) {
+                // Outside the inner box: away from its closest point.
+                g = Vec3(fmax(q.x(), 0.0), fmax(q.y(), 0.0), fmax(q.z(), 0.0));
+            } else {
+                // Inside: straight out through the nearest face.
+                int axis = q.x() > q.y() ? (q.x() > q.z() ? 0 : 2) : (q.y() > q.z() ? 1 : 2);
+                g[axis] = 1;
+            }
+            for (int a = 0; a < 3; a++) if (d[a] < 0) g[a] = -g[a];
+            return g;
+        }
+        virtual AABB bounds() const override { return AABB(center - halfExtents, center + halfExtents); }
+
+    public:
+        Point3 center;
+        Vec3 halfExtents;
+        double rounding;
+
+    private:
+        // How far p is outside the box that the rounding is wrapped around, per axis.
+        Vec3 excess(const Point3& p) const {
+            Vec3 d = p - center;
+            return Vec3(fabs(d.x()), fabs(d.y()), fabs(d.z())) - halfExtents + Vec3(rounding, rounding, rounding);
+        }
+};
+
+/**
+ * Two fields melted together: the union with the seam filled in over a width of about `blend` (polynomial smooth
+ * minimum). The blend only ever lowers the distance, so the result stays within the children's Lipschitz bounds.
+ */
+class SdfSmoothUnion : public DistanceField {
+    public:
+        SdfSmoothUnion(shared_ptr<DistanceField> a, shared_ptr<DistanceField> b, double blend) : a(a), b(b), blend(blend) {}
+
+        virtual double distance(const Point3& p) const override {
+            double da = a->distance(p), db = b->distance(p);
+            double h = weight(da, db);
+            return h * da + (1 - h) * db - blend * h * (1 - h);
+        }
+        // The terms from the weight's own derivative cancel out, leaving a blend of the two gradients.
+        virtual Vec3 gradient(const Point3& p) const override {
+            double h = weight(a->distance(p), b->distance(p));
+            return h * unitVector(a->gradient(p)) + (1 - h) * unitVector(b->gradient(p));
+        }
+        // The seam bulges out by at most blend / 4.
+        virtual AABB bounds() const override {
+            AABB box = surroundingBox(a->bounds(), b->bounds());
+            Vec3 bulge(blend / 4, blend / 4, blend / 4);
+            return AABB(box.min() - bulge, box.max() + bulge);
+        }
+        virtual double lipschitz() const override { return fmax(a->lipschitz(), b->lipschitz()); }
+
+    public:
+        shared_ptr<DistanceField> a;
+        shared_ptr<DistanceField> b;
+        double blend;
+
+    private:
+        // How much of `a` to take, 1 well inside a and 0 well inside b.
+        double weight(double da, double db) const { return clamp(0.5 + 0.5 * (db - da) / blend, 0.0, 1.0); }
+};
+
+/**
+ * The Mandelbulb fractal (power 8) scaled to `radius` around `center`, with the usual distance estimate from the
+ * running derivative. It has no closed form gradient, so normals use the default central differences. The estimate is
+ * a little optimistic close to the surface, the Lipschitz bound of 2 halves the steps to make up for it.
+ */
+class SdfMandelbulb : public DistanceField {
+    public:
+        SdfMandelbulb(Point3 center, double radius, int iterations = 10) : center(center), radius(radius), iterations(iterations) {}
+
+        virtual double distance(const Point3& p) const override {
+            // The set fits inside a sphere of about 1.2.
+            const double extent = 1.2;
+            Vec3 c = (p - center) * (extent / radius);
+            Vec3 z = c;
+            double dr = 1.0;
+            double r = z.length();
+            for (int i = 0; i < iterations && r < 2.0; i++) {
+                double theta = acos(z.z() / r) * 8;
+                double phi = atan2(z.y(), z.x()) * 8;
+                double r7 = pow(r, 7);
+                dr = 8 * r7 * dr + 1.0;
+                z = r7 * r * Vec3(sin(theta) * cos(phi), sin(theta) * sin(phi), cos(theta)) + c;
+                r = z.length();
+            }
+            if (r == 0) return 0;
+            return 0.5 * log(r) * r / dr * (radius / extent);
+        }
+        virtual AABB bounds() const override {
+            return AABB(center - Vec3(radius, radius, radius), center + Vec3(radius, radius, radius));
+        }
+        virtual double lipschitz() const override { return 2.0; }
+
+    public:
+        Point3 center;
+        double radius;
+        int iterations;
+};
+
+/**
+ * Renders a DistanceField by sphere tracing: march along the ray, each time by the distance to the nearest surface,
+ * until that distance drops below `epsilon`. Marching only happens inside the field's bounds. Rays that don't get
+ * there in `maxSteps` (grazing the surface, mostly) count as a miss.
+ */
+class ImplicitSurface : public Corporeal {
+    public:
+        ImplicitSurface(shared_ptr<DistanceField> field, shared_ptr<Material> mat, int maxSteps = 256, double epsilon = 1e-4)
+            : field(field), matPtr(mat), maxSteps(maxSteps), epsilon(epsilon) {
+            // Pad the bounds so the march starts off the surface even where it touches them.
+            AABB box = field->bounds();
+            Vec3 pad(2 * epsilon, 2 * epsilon, 2 * epsilon);
+            box = AABB(box.min() - pad, box.max() + pad);
+            bounds = box;
+        }
+
+        virtual bool hit(const Ray& r, double tMin, double tMax, HitRecord& rec) const override;
+        virtual void finishHit(const Ray& r, HitRecord& rec) const override;
+        virtual bool boundingBox(double time0, double time1, AABB& outputBox) const override {
+            outputBox = bounds;
+            return true;
+        }
+
+    public:
+        shared_ptr<DistanceField> field;
+        shared_ptr<Material> matPtr;
+        AABB bounds;
+        int maxSteps;
+        double epsilon;
+};
+
+bool ImplicitSurface::hit(const Ray& r, double tMin, double tMax, HitRecord& rec) const {
+    double t = tMin, tEnd = tMax;
+    if (!bounds.clip(r, t, tEnd)) return false;
+
+    const double rayLength = r.direction().length();
+    const double stepScale = 1.0 / (field->lipschitz() * rayLength);
+
+    // Rays can start inside (refraction) and march to the surface from there, the sign tells which side we're on.
+    double d = field->distance(r.at(t));
+    double side = d < 0 ? -1.0 : 1.0;
+    if (fabs(d) < epsilon) {
+        // Leaving the surface the ray just scattered off. Which side it's headed for decides what to look for next.
+        side = dot(field->gradient(r.at(t)), r.direction()) > 0 ? 1.0 : -1.0;
+        t += 2 * epsilon / rayLength;
+        d = field->distance(r.at(t));
+    }
+
+    for (int i = 0; i < maxSteps && t <= tEnd; i++) {
+        double ahead = side * d;
+        if (ahead < epsilon) {
+            rec.t = t;
+            rec.object = this;
+            return true;
+        }
+        t += ahead * stepScale;
+        d = field->distance(r.at(t));
+    }
+    return false;
+}
+
+void ImplicitSurface::finishHit(const Ray& r, HitRecord& rec) const {
+    rec.p = r.at(rec.t);
+    rec.setFaceNormal(r, unitVector(field->gradient(rec.p)));
+    // Fields have no parameterisation, solid textures still work.
+    rec.u = rec.v = 0;
+    rec.matPtr = matPtr;
+}
+
+#endif
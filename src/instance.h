@@ -0,0 +1,79 @@
+#ifndef INSTANCE_H
+#define INSTANCE_H
+
+#include "tracer.h"
+#include "corporeal.h"
+#include "aabb.h"
+#include "transform.h"
+
+/**
+ * Places a Corporeal somewhere else, rotated and/or scaled, without copying it. Many instances can share one heavy
+ * mesh. The ray is moved into the object's own space with the inverse transform, which is computed once here, and
+ * the hit is moved back out. The direction isn't normalised in object space, so t means the same on both sides.
+ */
+class Instance : public Corporeal {
+    public:
+        Instance() {}
+        Instance(shared_ptr<Corporeal> obj, const Transform& objectToWorld)
+            : object(obj), objectToWorld(objectToWorld), worldToObject(objectToWorld.inverse()),
+              translationOnly(objectToWorld.isTranslation()), offset(objectToWorld.translation()) {}
+
+        virtual bool hit(const Ray& r, double tMin, double tMax, HitRecord& rec) const override;
+        virtual bool boundingBox(double time0, double time1, AABB& outputBox) const override;
+
+    public:
+        shared_ptr<Corporeal> object;
+        Transform objectToWorld;
+        Transform worldToObject;
+        // Moving things around is by far the most common, it gets away with an add instead of matrix products.
+        bool translationOnly;
+        Vec3 offset;
+};
+
+bool Instance::hit(const Ray& r, double tMin, double tMax, HitRecord& rec) const {
+    if (translationOnly) {
+        Ray localRay(r.origin() - offset, r.direction(), r.time());
+        if (!object->hit(localRay, tMin, tMax, rec)) return false;
+        // Finish while still in object space, like LinearMotion does.
+        rec.finish(localRay);
+        rec.p += offset;
+        return true;
+    }
+
+    Ray localRay(worldToObject.applyPoint(r.origin()), worldToObject.applyVector(r.direction()), r.time());
+    if (!object->hit(localRay, tMin, tMax, rec)) return false;
+
+    rec.finish(localRay);
+    rec.p = objectToWorld.applyPoint(rec.p);
+    // The normal already faces the ray in object space, and the inverse transpose keeps it on the same side.
+    rec.normal = unitVector(worldToObject.applyTransposed(rec.normal));
+    return true;
+}
+
+bool Instance::boundingBox(double time0, double time1, AABB& outputBox) const {
+    AABB objectBox;
+    if (!object->boundingBox(time0, time1, objectBox)) return false;
+    if (translationOnly) {
+        outputBox = AABB(objectBox.min() + offset, objectBox.max() + offset);
+        return true;
+    }
+
+    // The box around all eight transformed corners, which is tight for the transformed box.
+    Point3 minPoint(infinity, infinity, infinity);
+    Point3 maxPoint(-infinity, -infinity, -infinity);
+    for (int corner = 0; corner < 8; corner++) {
+        Point3 p(
+            corner & 1 ? objectBox.max().x() : objectBox.min().x(),
+            corner & 2 ? objectBox.max().y() : objectBox.min().y(),
+            corner & 4 ? objectBox.max().z() : objectBox.min().z());
+        p = objectToWorld.applyPoint(p);
+        for (int a = 0; a < 3; a++) {
+            minPoint[a] = fmin(minPoint[a], p[a]);
+            maxPoint[a] = fmax(maxPoint[a], p[a]);
+        }
+    }
+    outputBox = AABB(minPoint, maxPoint);
+    return true;
+}
+
+#endif
@@ -0,0 +1,171 @@
+#ifndef MAPPED_FILE_H
+#define MAPPED_FILE_H
+
+#include <algorithm>
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include <iostream>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "unistd.h"
+
+/**
+ * A read-only memory mapping of a whole file. Pages are only read from disk when they are touched, so loaders can
+ * parse or use the data in place without first copying it into their own buffers.
+ */
+class MappedFile {
+    public:
+        MappedFile(const char* filename) : bytes(nullptr), length(0) {
+            int fd = open(filename, O_RDONLY);
+            if (fd < 0) {
+                std::cerr << "ERROR: Could not open file '" << filename << "'.\n";
+                return;
+            }
+
+            struct stat info;
+            if (fstat(fd, &info) == 0 && info.st_size > 0) {
+                void* mapped = mmap(nullptr, info.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+                if (mapped != MAP_FAILED) {
+                    bytes = static_cast<const char*>(mapped);
+                    length = info.st_size;
+                    // We read front to back, let the kernel read ahead aggressively.
+                    madvise(mapped, length, MADV_SEQUENTIAL);
+                } else {
+                    std::cerr << "ERROR: Could not map file '" << filename << "'.\n";
+                }
+            }
+            // The mapping stays valid after closing the descriptor.
+            close(fd);
+        }
+
+        ~MappedFile() {
+            if (bytes) munmap(const_cast<char*>(bytes), length);
+        }
+
+        // A mapping can't be copied, share it through a shared_ptr instead.
+        MappedFile(const MappedFile&) = delete;
+        MappedFile& operator=(const MappedFile&) = delete;
+
+        // Tells the kernel how the pages will be used from now on, like MADV_RANDOM for data that is used in place.
+        void advise(int advice) const {
+            if (bytes) madvise(const_cast<char*>(bytes), length, advice);
+        }
+
+        /**
+         * Lets the kernel drop the pages of a part of the file that won't be needed for a while, they are read again
+         * if it is touched after all. Only pages lying entirely inside the range are dropped.
+         */
+        void release(size_t offset, size_t count) const {
+            if (!bytes) return;
+            const size_t page = (size_t)sysconf(_SC_PAGESIZE);
+            size_t first = (offset + page - 1) / page * page;
+            size_t last = std::min(offset + count, length) / page * page;
+            if (last > first) madvise(const_cast<char*>(bytes) + first, last - first, MADV_DONTNEED);
+        }
+
+        bool valid() const { return bytes != nullptr; }
+        const char* data() const { return bytes; }
+        const char* end() const { return bytes + length; }
+        size_t size() const { return length; }
+
+    private:
+        const char* bytes;
+        size_t length;
+};
+
+//// Helpers to scan text in place. They never read past `end`, as a mapped file is not null terminated.
+
+inline bool isLineSpace(char c) { return c == ' ' || c == '\t' || c == '\r'; }
+
+inline void skipSpaces(const char*& p, const char* end) {
+    while (p < end && isLineSpace(*p)) p++;
+}
+
+// Moves p to the start of the next line.
+inline void skipLine(const char*& p, const char* end) {
+    while (p < end && *p != '\n') p++;
+    if (p < end) p++;
+}
+
+// Whether p is at `keyword` followed by a space or the end of the line. Moves past the keyword if so.
+inline bool matchKeyword(const char*& p, const char* end, const char* keyword) {
+    const char* q = p;
+    while (*keyword) {
+        if (q >= end || *q != *keyword) return false;
+        q++;
+        keyword++;
+    }
+    if (q < end && !isLineSpace(*q) && *q != '\n') return false;
+    p = q;
+    return true;
+}
+
+// Reads the next whitespace separated word, returns its length. `word` points into the file.
+inline size_t parseWord(const char*& p, const char* end, const char*& word) {
+    skipSpaces(p, end);
+    word = p;
+    while (p < end && !isLineSpace(*p) && *p != '\n') p++;
+    return p - word;
+}
+
+// Reads a (possibly signed) integer. Returns false if there is no number at p.
+inline bool parseInt(const char*& p, const char* end, long& value) {
+    skipSpaces(p, end);
+    bool negative = false;
+    if (p < end && (*p == '-' || *p == '+')) negative = (*p++ == '-');
+    if (p >= end || *p < '0' || *p > '9') return false;
+
+    long result = 0;
+    while (p < end && *p >= '0' && *p <= '9') result = result * 10 + (*p++ - '0');
+    value = negative ? -result : result;
+    return true;
+}
+
+// Reads a decimal floating point number like 1, -0.5, .25 or 1.5e-3. Returns false if there is no number at p.
+inline bool parseDouble(const char*& p, const char* end, double& value) {
+    skipSpaces(p, end);
+    bool negative = false;
+    if (p < end && (*p == '-' || *p == '+')) negative = (*p++ == '-');
+
+    // Collect up to 18 significant digits in an integer, that is all a double can hold anyway.
+    uint64_t mantissa = 0;
+    int exponent = 0;
+    int digits = 0;
+    bool any = false;
+    while (p < end && *p >= '0' && *p <= '9') {
+        if (digits < 18) { mantissa = mantissa * 10 + (*p - '0'); if (mantissa) digits++; }
+        else exponent++;
+        p++;
+        any = true;
+    }
+    if (p < end && *p == '.') {
+        p++;
+        while (p < end && *p >= '0' && *p <= '9') {
+            if (digits < 18) { mantissa = mantissa * 10 + (*p - '0'); if (mantissa) digits++; exponent--; }
+            p++;
+            any = true;
+        }
+    }
+    if (!any) return false;
+
+    if (p < end && (*p == 'e' || *p == 'E')) {
+        const char* q = p + 1;
+        long e;
+        if (parseInt(q, end, e)) {
+            exponent += (int)e;
+            p = q;
+        }
+    }
+
+    double result = (double)mantissa;
+    // Dividing by an exact power of ten rounds better than multiplying by an inexact negative one.
+    if (exponent > 0) result *= pow(10.0, exponent);
+    else if (exponent < 0) result /= pow(10.0, -exponent);
+    value = negative ? -result : result;
+    return true;
+}
+
+#endif
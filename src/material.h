@@ -3,6 +3,7 @@
 
 #include "tracer.h"
 #include "texture.h"
+#include "fastMath.h"
 
 struct HitRecord;
 
@@ -31,7 +32,7 @@ class Lambertian : public Material {
                 scatterDirection = rec.normal;
             }
 
-            scattered = Ray(rec.p, scatterDirection);
+            scattered = Ray(rec.p, scatterDirection, rayIn.time());
             attenuation = albedo->value(rec.u, rec.v, rec.p);
             return true;
         }
@@ -48,7 +49,7 @@ class HemisphereDiffuse : public Material {
         ) const override {
             auto scatterDirection = rec.p + randomInHemisphere(rec.normal);
             if (scatterDirection.nearZero()) scatterDirection = rec.normal;
-            scattered = Ray(rec.p, scatterDirection);
+            scattered = Ray(rec.p, scatterDirection, rayIn.time());
             attenuation = albedo;
             return true;
         }
@@ -65,7 +66,7 @@ class Metal : public Material {
         ) const override {
             // Metal directly reflects rays. If there is some fuzziness factor < 1, the reflection is disturbed a bit.
             Vec3 reflected = reflect(unitVector(r.direction()), rec.normal);
-            scattered = Ray(rec.p, reflected + fuzz * randomVectorInUnitSphere());
+            scattered = Ray(rec.p, reflected + fuzz * randomVectorInUnitSphere(), r.time());
             attenuation = albedo;
 
             return (dot(scattered.direction(), rec.normal) > 0);
@@ -101,7 +102,7 @@ class Dielectric : public Material {
             } 
 
 
-            scattered = Ray(rec.p, direction);
+            scattered = Ray(rec.p, direction, rIn.time());
             return true;
         }
 
@@ -111,7 +112,7 @@ class Dielectric : public Material {
         //Christophe Schlick's polynomial reflectance approximation for reflectivity variance over angles
         static double reflectance(double cosine, double referenceIndex) {
             auto r0 = (1 - referenceIndex) / (1 + referenceIndex);
-            return r0 * r0 + (1 - r0) * pow((1-cosine), 5);
+            return r0 * r0 + (1 - r0) * pow5(1-cosine);
         }
 
 };
@@ -133,4 +134,20 @@ class DiffuseLight : public Material {
         shared_ptr<Texture> emit;
 };
 
+// Phase function of a participating medium: scatters the same amount in every direction.
+class Isotropic : public Material {
+    public:
+        Isotropic(Color c) : albedo(make_shared<SolidColor>(c)) {}
+        Isotropic(shared_ptr<Texture> a) : albedo(a) {}
+
+        virtual bool scatter(const Ray& rIn, const HitRecord& rec, Color& attenuation, Ray& scattered) const override {
+            scattered = Ray(rec.p, randomUnitVector(), rIn.time());
+            attenuation = albedo->value(rec.u, rec.v, rec.p);
+            return true;
+        }
+
+    public:
+        shared_ptr<Texture> albedo;
+};
+
 #endif
\ No newline at end of file
@@ -0,0 +1,151 @@
+#ifndef MEDIUM_H
+#define MEDIUM_H
+
+#include "tracer.h"
+#include "corporeal.h"
+#include "aabb.h"
+#include "material.h"
+#include "densityGrid.h"
+
+/**
+ * The stretch [t1, t2] of the ray within [tMin, tMax] that lies inside `boundary`. The boundary must be closed and
+ * convex, like a sphere or a box. Rays that start inside (scattered in the medium) get t1 = tMin.
+ */
+inline bool boundaryInterval(const Corporeal& boundary, const Ray& r, double tMin, double tMax, double& t1, double& t2) {
+    HitRecord rec1, rec2;
+    if (!boundary.hit(r, -infinity, infinity, rec1)) return false;
+    if (!boundary.hit(r, rec1.t + 0.0001, infinity, rec2)) return false;
+
+    t1 = fmax(rec1.t, tMin);
+    t2 = fmin(rec2.t, tMax);
+    if (t1 >= t2) return false;
+    t1 = fmax(t1, 0.0);
+    return true;
+}
+
+/**
+ * Delta tracking: finds where a ray first collides with a heterogeneous medium between t1 and t2. `majorants` walks
+ * the stretch as pieces with a density that is never exceeded in them (see MajorantGrid::traverse), `volume` gives the
+ * actual density at a point. Both are scaled by `densityScale`.
+ */
+template <typename Majorants, typename Volume>
+bool deltaTracking(const Ray& r, double t1, double t2, double densityScale, const Majorants& majorants, const Volume& volume,
+    double& tHit) {
+    const double rayLength = r.direction().length();
+    bool collided = false;
+    majorants.traverse(r, t1, t2, [&](double tEnter, double tExit, double majorant) {
+        if (majorant <= 0) return true;
+        // Extinction per unit of t rather than of distance.
+        double sigma = majorant * densityScale * rayLength;
+        double t = tEnter;
+        while (true) {
+            // Free flight is memoryless, so starting over at the next piece with its own majorant is fine.
+            t -= log(1 - randomDouble()) / sigma;
+            if (t >= tExit) return true;
+            if (randomDouble() * majorant < volume.density(r.at(t))) {
+                tHit = t;
+                collided = true;
+                return false;
+            }
+        }
+    });
+    return collided;
+}
+
+/**
+ * Fog or smoke of the same density everywhere inside `boundary`. A ray scatters after an exponentially distributed
+ * distance, which is sampled directly, so this costs two boundary hits and a log no matter how big the volume is.
+ */
+class ConstantMedium : public Corporeal {
+    public:
+        ConstantMedium(shared_ptr<Corporeal> boundary, double density, shared_ptr<Texture> albedo)
+            : boundary(boundary), negInvDensity(-1 / density), phaseFunction(make_shared<Isotropic>(albedo)) {}
+        ConstantMedium(shared_ptr<Corporeal> boundary, double density, Color albedo)
+            : boundary(boundary), negInvDensity(-1 / density), phaseFunction(make_shared<Isotropic>(albedo)) {}
+
+        virtual bool hit(const Ray& r, double tMin, double tMax, HitRecord& rec) const override;
+        virtual void finishHit(const Ray& r, HitRecord& rec) const override;
+        virtual bool boundingBox(double time0, double time1, AABB& outputBox) const override {
+            return boundary->boundingBox(time0, time1, outputBox);
+        }
+
+    public:
+        shared_ptr<Corporeal> boundary;
+        double negInvDensity;
+        shared_ptr<Material> phaseFunction;
+};
+
+/**
+ * Smoke with a density that varies, given by a DensityGrid, inside `boundary`. Collisions are found with delta
+ * tracking: steps are sampled against a majorant (a density that is never exceeded) and accepted with the ratio of
+ * the real density to it. The majorant comes from a coarse MajorantGrid walked cell by cell, so thin regions get long
+ * steps and empty ones are skipped without sampling.
+ */
+class GridMedium : public Corporeal {
+    public:
+        // `densityScale` turns the values in the grid into extinction per unit of distance.
+        GridMedium(shared_ptr<Corporeal> boundary, shared_ptr<DensityGrid> grid, double densityScale, Color albedo)
+            : boundary(boundary), grid(grid), majorants(*grid), densityScale(densityScale),
+              phaseFunction(make_shared<Isotropic>(albedo)) {}
+
+        virtual bool hit(const Ray& r, double tMin, double tMax, HitRecord& rec) const override;
+        virtual void finishHit(const Ray& r, HitRecord& rec) const override;
+        virtual bool boundingBox(double time0, double time1, AABB& outputBox) const override {
+            return boundary->boundingBox(time0, time1, outputBox);
+        }
+
+    public:
+        shared_ptr<Corporeal> boundary;
+        shared_ptr<DensityGrid> grid;
+        MajorantGrid majorants;
+        double densityScale;
+        shared_ptr<Material> phaseFunction;
+
+    private:
+        // Narrows the ray down to the part inside both the boundary and the grid.
+        bool interval(const Ray& r, double tMin, double tMax, double& t1, double& t2) const {
+            return boundaryInterval(*boundary, r, tMin, tMax, t1, t2) && grid->bounds.clip(r, t1, t2);
+        }
+};
+
+bool ConstantMedium::hit(const Ray& r, double tMin, double tMax, HitRecord& rec) const {
+    double t1, t2;
+    if (!boundaryInterval(*boundary, r, tMin, tMax, t1, t2)) return false;
+
+    const auto rayLength = r.direction().length();
+    const auto distanceInsideBoundary = (t2 - t1) * rayLength;
+    const auto hitDistance = negInvDensity * log(randomDouble());
+    if (hitDistance > distanceInsideBoundary) return false;
+
+    rec.t = t1 + hitDistance / rayLength;
+    rec.object = this;
+    return true;
+}
+
+void ConstantMedium::finishHit(const Ray& r, HitRecord& rec) const {
+    rec.p = r.at(rec.t);
+    // A medium has no surface, these are arbitrary.
+    rec.normal = Vec3(1, 0, 0);
+    rec.frontFace = true;
+    rec.u = rec.v = 0;
+    rec.matPtr = phaseFunction;
+}
+
+bool GridMedium::hit(const Ray& r, double tMin, double tMax, HitRecord& rec) const {
+    double t1, t2;
+    if (!interval(r, tMin, tMax, t1, t2)) return false;
+    if (!deltaTracking(r, t1, t2, densityScale, majorants, *grid, rec.t)) return false;
+
+    rec.object = this;
+    return true;
+}
+
+void GridMedium::finishHit(const Ray& r, HitRecord& rec) const {
+    rec.p = r.at(rec.t);
+    rec.normal = Vec3(1, 0, 0);
+    rec.frontFace = true;
+    rec.u = rec.v = 0;
+    rec.matPtr = phaseFunction;
+}
+
+#endif
@@ -0,0 +1,41 @@
+#ifndef MESH_BUFFER_H
+#define MESH_BUFFER_H
+
+#include <memory>
+#include <vector>
+
+using std::shared_ptr;
+using std::make_shared;
+
+/**
+ * A read-only array of mesh data. It either owns its elements, or points into memory someone else owns (like a mapped
+ * file) and keeps that alive through `storage`. This lets loaders hand over data they can use in place without a copy.
+ */
+template <typename T>
+class MeshBuffer {
+    public:
+        MeshBuffer() : ptr(nullptr), count(0), owned(false) {}
+        MeshBuffer(std::vector<T> elements) : owned(true) {
+            auto vector = make_shared<std::vector<T>>(std::move(elements));
+            ptr = vector->data();
+            count = vector->size();
+            storage = vector;
+        }
+        MeshBuffer(const T* data, size_t count, shared_ptr<const void> storage)
+            : ptr(data), count(count), owned(false), storage(storage) {}
+
+        const T& operator[](size_t i) const { return ptr[i]; }
+        const T* data() const { return ptr; }
+        size_t size() const { return count; }
+        bool empty() const { return count == 0; }
+        // Heap memory used by this buffer. Borrowed data is someone else's (the page cache for mapped files).
+        size_t ownedBytes() const { return owned ? count * sizeof(T) : 0; }
+
+    private:
+        const T* ptr;
+        size_t count;
+        bool owned;
+        shared_ptr<const void> storage;
+};
+
+#endif
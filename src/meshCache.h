@@ -0,0 +1,315 @@
+#ifndef MESH_CACHE_H
+#define MESH_CACHE_H
+
+#include "tracer.h"
+#include "corporealList.h"
+#include "material.h"
+#include "triangleMesh.h"
+#include "mappedFile.h"
+#include "objLoader.h"
+#include "plyLoader.h"
+
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <fstream>
+#include <string>
+#include <vector>
+
+/**
+ * A binary cache of imported meshes, made to be used straight out of a memory mapping. The file starts with a header
+ * and a table with one entry per mesh, followed by every mesh's arrays. Each array starts on a 64 byte boundary and
+ * is laid out exactly like the MeshBuffer that will point at it, so loading is only validating the header and table.
+ * Materials are not stored: every loaded mesh gets the material passed to the loader.
+ */
+
+const char meshCacheMagic[8] = { 'R', 'T', 'M', 'E', 'S', 'H', 0, 0 };
+// Bump this whenever the layout of the file, FlatBvhNode or the BVH builder changes.
+const uint32_t meshCacheVersion = 2;
+// Written as is, reads back differently on a machine with the other byte order.
+const uint32_t meshCacheEndianTag = 0x01020304;
+const uint64_t meshCacheAlignment = 64;
+
+struct MeshCacheHeader {
+    char magic[8];
+    uint32_t version;
+    uint32_t endianTag;
+    uint64_t meshCount;
+    uint64_t fileSize;
+};
+
+// Location of one array in the file. Offsets are from the start of the file, counts are in elements.
+struct MeshCacheArray {
+    uint64_t offset;
+    uint64_t count;
+};
+
+struct MeshCacheEntry {
+    MeshCacheArray positions;
+    MeshCacheArray normals;
+    MeshCacheArray uvs;
+    MeshCacheArray indices;
+    // All three empty if the BVH wasn't stored, it is then built and the vertices packed on load.
+    MeshCacheArray bvhNodes;
+    MeshCacheArray bvhPrimIndices;
+    // TriangleMesh::packedVertices, which follow the leaf order of the stored BVH.
+    MeshCacheArray packedVertices;
+    float boundsMin[3];
+    float boundsMax[3];
+};
+
+inline uint64_t alignMeshCacheOffset(uint64_t offset) {
+    return (offset + meshCacheAlignment - 1) / meshCacheAlignment * meshCacheAlignment;
+}
+
+/**
+ * Writes every TriangleMesh in `meshes` to a cache file, other objects are skipped. With `includeBvh` the built trees
+ * are stored too, so loading doesn't have to rebuild them. Returns false if the file can't be written.
+ */
+bool writeMeshCache(const char* filename, const CorporealList& meshes, bool includeBvh = true) {
+    std::vector<const TriangleMesh*> sources;
+    for (const auto& object : meshes.objects) {
+        auto mesh = dynamic_cast<const TriangleMesh*>(object.get());
+        if (mesh) sources.push_back(mesh);
+        else std::cerr << "WARNING: Mesh cache '" << filename << "' skips an object that is no TriangleMesh.\n";
+    }
+
+    // Lay out the file first, so the table can be written before the data.
+    std::vector<MeshCacheEntry> entries(sources.size());
+    uint64_t offset = alignMeshCacheOffset(sizeof(MeshCacheHeader) + sources.size() * sizeof(MeshCacheEntry));
+    auto place = [&offset](MeshCacheArray& array, uint64_t count, uint64_t elementSize) {
+        array.offset = count > 0 ? offset : 0;
+        array.count = count;
+        offset = alignMeshCacheOffset(offset + count * elementSize);
+    };
+    for (size_t i = 0; i < sources.size(); i++) {
+        const TriangleMesh& mesh = *sources[i];
+        MeshCacheEntry& entry = entries[i];
+        place(entry.positions, mesh.positions.size(), sizeof(float));
+        place(entry.normals, mesh.normals.size(), sizeof(float));
+        place(entry.uvs, mesh.uvs.size(), sizeof(float));
+        place(entry.indices, mesh.indices.size(), sizeof(uint32_t));
+        place(entry.bvhNodes, includeBvh ? mesh.bvh.nodes.size() : 0, sizeof(FlatBvhNode));
+        place(entry.bvhPrimIndices, includeBvh ? mesh.bvh.primIndices.size() : 0, sizeof(uint32_t));
+        place(entry.packedVertices, includeBvh ? mesh.packedVertices.size() : 0, sizeof(float));
+
+        AABB bounds;
+        mesh.boundingBox(0, 0, bounds);
+        for (int a = 0; a < 3; a++) {
+            entry.boundsMin[a] = (float)bounds.min()[a];
+            entry.boundsMax[a] = (float)bounds.max()[a];
+        }
+    }
+
+    MeshCacheHeader header;
+    memcpy(header.magic, meshCacheMagic, sizeof(header.magic));
+    header.version = meshCacheVersion;
+    header.endianTag = meshCacheEndianTag;
+    header.meshCount = sources.size();
+    header.fileSize = offset;
+
+    std::ofstream out(filename, std::ios::binary | std::ios::trunc);
+    if (!out) {
+        std::cerr << "ERROR: Could not write mesh cache '" << filename << "'.\n";
+        return false;
+    }
+
+    // Writes an array at its offset, padding the gap since the previous one with zeros.
+    auto write = [&out](const MeshCacheArray& array, const void* data, uint64_t elementSize) {
+        if (array.count == 0) return;
+        static const char zeros[meshCacheAlignment] = {};
+        out.write(zeros, array.offset - (uint64_t)out.tellp());
+        out.write(static_cast<const char*>(data), array.count * elementSize);
+    };
+    out.write(reinterpret_cast<const char*>(&header), sizeof(header));
+    out.write(reinterpret_cast<const char*>(entries.data()), entries.size() * sizeof(MeshCacheEntry));
+    for (size_t i = 0; i < sources.size(); i++) {
+        const TriangleMesh& mesh = *sources[i];
+        const MeshCacheEntry& entry = entries[i];
+        write(entry.positions, mesh.positions.data(), sizeof(float));
+        write(entry.normals, mesh.normals.data(), sizeof(float));
+        write(entry.uvs, mesh.uvs.data(), sizeof(float));
+        write(entry.indices, mesh.indices.data(), sizeof(uint32_t));
+        write(entry.bvhNodes, mesh.bvh.nodes.data(), sizeof(FlatBvhNode));
+        write(entry.bvhPrimIndices, mesh.bvh.primIndices.data(), sizeof(uint32_t));
+        write(entry.packedVertices, mesh.packedVertices.data(), sizeof(float));
+    }
+    // Pad the end too, so the file is as long as the header says.
+    static const char zeros[meshCacheAlignment] = {};
+    out.write(zeros, offset - (uint64_t)out.tellp());
+
+    if (!out) {
+        std::cerr << "ERROR: Could not write mesh cache '" << filename << "'.\n";
+        return false;
+    }
+    return true;
+}
+
+/**
+ * Checks that the arrays of an entry fit together: whole triangles and vertices, indices that name existing
+ * vertices, and a BVH whose nodes and primitive indices stay inside their arrays. Traversal and shading trust all of
+ * these, so a damaged file would otherwise read out of bounds.
+ */
+bool meshCacheEntryValid(const MappedFile& file, const MeshCacheEntry& entry) {
+    auto inside = [&file](const MeshCacheArray& array, uint64_t elementSize) {
+        return array.count == 0 || (array.offset % meshCacheAlignment == 0 && array.offset <= file.size()
+            && array.count <= (file.size() - array.offset) / elementSize);
+    };
+    if (!inside(entry.positions, sizeof(float)) || !inside(entry.normals, sizeof(float)) || !inside(entry.uvs, sizeof(float))
+        || !inside(entry.indices, sizeof(uint32_t)) || !inside(entry.bvhNodes, sizeof(FlatBvhNode))
+        || !inside(entry.bvhPrimIndices, sizeof(uint32_t)) || !inside(entry.packedVertices, sizeof(float))) return false;
+
+    uint64_t vertexCount = entry.positions.count / 3;
+    uint64_t triangleCount = entry.indices.count / 3;
+    if (entry.positions.count % 3 != 0 || entry.indices.count % 3 != 0 || vertexCount > UINT32_MAX
+        || triangleCount > UINT32_MAX || (entry.normals.count != 0 && entry.normals.count != 3 * vertexCount)
+        || (entry.uvs.count != 0 && entry.uvs.count != 2 * vertexCount)
+        || entry.bvhPrimIndices.count != (entry.bvhNodes.count > 0 ? triangleCount : 0)
+        || entry.packedVertices.count != (entry.bvhNodes.count > 0 ? 9 * TriangleMesh::packedVertexStride(triangleCount) : 0)) return false;
+
+    const uint32_t* indices = reinterpret_cast<const uint32_t*>(file.data() + entry.indices.offset);
+    for (uint64_t i = 0; i < entry.indices.count; i++) {
+        if (indices[i] >= vertexCount) return false;
+    }
+
+    const uint32_t* primIndices = reinterpret_cast<const uint32_t*>(file.data() + entry.bvhPrimIndices.offset);
+    for (uint64_t i = 0; i < entry.bvhPrimIndices.count; i++) {
+        if (primIndices[i] >= triangleCount) return false;
+    }
+
+    // The builder always puts children after their parent, which also rules out cycles. Traversal keeps a stack of
+    //  64 nodes, so the tree can't be deeper than that.
+    const FlatBvhNode* nodes = reinterpret_cast<const FlatBvhNode*>(file.data() + entry.bvhNodes.offset);
+    std::vector<uint8_t> depth(entry.bvhNodes.count, 0);
+    for (uint64_t i = 0; i < entry.bvhNodes.count; i++) {
+        const FlatBvhNode& node = nodes[i];
+        if (node.count > 0) {
+            if (node.count > FlatBvh::maxLeafSize || node.offset + (uint64_t)node.count > entry.bvhPrimIndices.count) return false;
+        } else {
+            if (node.axis > 2 || node.offset <= i || node.offset + 1ull >= entry.bvhNodes.count || depth[i] >= 63) return false;
+            for (uint64_t child = node.offset; child <= node.offset + 1ull; child++) {
+                depth[child] = std::max<uint8_t>(depth[child], depth[i] + 1);
+            }
+        }
+    }
+    return true;
+}
+
+/**
+ * Maps a cache file and checks its header and every entry in the table with meshCacheEntryValid. This reads the
+ * indices and trees once. Returns nullptr if the file is missing, from another version or damaged.
+ */
+shared_ptr<MappedFile> openMeshCache(const char* filename) {
+    auto file = make_shared<MappedFile>(filename);
+    if (!file->valid()) return nullptr;
+
+    if (file->size() < sizeof(MeshCacheHeader)) {
+        std::cerr << "ERROR: Mesh cache '" << filename << "' is too small.\n";
+        return nullptr;
+    }
+    const MeshCacheHeader* header = reinterpret_cast<const MeshCacheHeader*>(file->data());
+    // Bound the count before multiplying, a huge one would wrap around and pass.
+    if (memcmp(header->magic, meshCacheMagic, sizeof(meshCacheMagic)) != 0 || header->endianTag != meshCacheEndianTag
+        || header->version != meshCacheVersion || header->fileSize != file->size()
+        || header->meshCount > (file->size() - sizeof(MeshCacheHeader)) / sizeof(MeshCacheEntry)) {
+        std::cerr << "ERROR: Mesh cache '" << filename << "' is from another version or damaged.\n";
+        return nullptr;
+    }
+
+    const MeshCacheEntry* entries = reinterpret_cast<const MeshCacheEntry*>(file->data() + sizeof(MeshCacheHeader));
+    for (uint64_t i = 0; i < header->meshCount; i++) {
+        if (!meshCacheEntryValid(*file, entries[i])) {
+            std::cerr << "ERROR: Mesh cache '" << filename << "' is damaged.\n";
+            return nullptr;
+        }
+    }
+    return file;
+}
+
+inline uint64_t meshCacheCount(const MappedFile& file) {
+    return reinterpret_cast<const MeshCacheHeader*>(file.data())->meshCount;
+}
+
+inline const MeshCacheEntry& meshCacheEntry(const MappedFile& file, uint64_t i) {
+    return reinterpret_cast<const MeshCacheEntry*>(file.data() + sizeof(MeshCacheHeader))[i];
+}
+
+/**
+ * The mesh of one entry of a file checked by openMeshCache, with its arrays used in place. `storage` is kept alive
+ * as long as the mesh is, it has to keep the mapping alive.
+ */
+shared_ptr<TriangleMesh> meshFromCacheEntry(const MappedFile& file, const MeshCacheEntry& entry, shared_ptr<Material> mat,
+    shared_ptr<const void> storage) {
+    auto borrow = [&file](const MeshCacheArray& array) -> const void* {
+        return array.count > 0 ? file.data() + array.offset : nullptr;
+    };
+
+    FlatBvh bvh;
+    MeshBuffer<float> packed;
+    if (entry.bvhNodes.count > 0) {
+        bvh.nodes = MeshBuffer<FlatBvhNode>(static_cast<const FlatBvhNode*>(borrow(entry.bvhNodes)), entry.bvhNodes.count, storage);
+        bvh.primIndices = MeshBuffer<uint32_t>(static_cast<const uint32_t*>(borrow(entry.bvhPrimIndices)), entry.bvhPrimIndices.count, storage);
+        packed = MeshBuffer<float>(static_cast<const float*>(borrow(entry.packedVertices)), entry.packedVertices.count, storage);
+    }
+    return make_shared<TriangleMesh>(
+        MeshBuffer<float>(static_cast<const float*>(borrow(entry.positions)), entry.positions.count, storage),
+        MeshBuffer<uint32_t>(static_cast<const uint32_t*>(borrow(entry.indices)), entry.indices.count, storage),
+        mat,
+        MeshBuffer<float>(static_cast<const float*>(borrow(entry.normals)), entry.normals.count, storage),
+        MeshBuffer<float>(static_cast<const float*>(borrow(entry.uvs)), entry.uvs.count, storage),
+        bvh,
+        packed
+    );
+}
+
+/**
+ * Maps a cache file and adds its meshes to `meshes`. All arrays are used in place and the meshes keep the mapping
+ * alive. Returns false if the file is missing, from another version or damaged.
+ */
+bool loadMeshCache(const char* filename, CorporealList& meshes, shared_ptr<Material> material = nullptr) {
+    shared_ptr<MappedFile> file = openMeshCache(filename);
+    if (!file) return false;
+
+    auto mat = material ? material : make_shared<Lambertian>(Color(0.7, 0.7, 0.7));
+    for (uint64_t i = 0; i < meshCacheCount(*file); i++) {
+        meshes.add(meshFromCacheEntry(*file, meshCacheEntry(*file, i), mat, file));
+    }
+
+    // The data is used in place, and rays read it in no particular order.
+    file->advise(MADV_RANDOM);
+    return true;
+}
+
+// Modification time of a file, 0 if it doesn't exist.
+inline time_t fileModificationTime(const char* filename) {
+    struct stat info;
+    return stat(filename, &info) == 0 ? info.st_mtime : 0;
+}
+
+/**
+ * Loads an OBJ or PLY file through its cache `<filename>.rtmesh`. If the cache is missing or older than the file, the
+ * file is imported as usual and the cache is (re)written for the next run. As the cache holds no materials,
+ * `material` is used for every mesh either way.
+ */
+bool loadMeshCached(const char* filename, CorporealList& meshes, shared_ptr<Material> material = nullptr) {
+    std::string cacheName = std::string(filename) + ".rtmesh";
+    time_t sourceTime = fileModificationTime(filename);
+    time_t cacheTime = fileModificationTime(cacheName.c_str());
+    if (cacheTime != 0 && cacheTime >= sourceTime && loadMeshCache(cacheName.c_str(), meshes, material)) return true;
+
+    auto mat = material ? material : make_shared<Lambertian>(Color(0.7, 0.7, 0.7));
+    std::string name(filename);
+    std::string extension = name.substr(name.find_last_of('.') + 1);
+    CorporealList imported;
+    bool loaded = false;
+    if (extension == "obj" || extension == "OBJ") loaded = loadObj(filename, imported, mat);
+    else if (extension == "ply" || extension == "PLY") loaded = loadPly(filename, imported, mat);
+    else std::cerr << "ERROR: Don't know how to load '" << filename << "'.\n";
+    if (!loaded) return false;
+
+    writeMeshCache(cacheName.c_str(), imported);
+    for (const auto& mesh : imported.objects) meshes.add(mesh);
+    return true;
+}
+
+#endif
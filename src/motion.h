@@ -0,0 +1,60 @@
+#ifndef MOTION_H
+#define MOTION_H
+
+#include "tracer.h"
+#include "corporeal.h"
+#include "aabb.h"
+
+/**
+ * Moves any Corporeal linearly over the shutter interval. At time0 the object is where it was built, at time1 it
+ * has been moved by `displacement`. Instead of moving the object we move the ray in the opposite direction, so the
+ * wrapped geometry never has to be copied or rebuilt.
+ */
+class LinearMotion : public Corporeal {
+    public:
+        LinearMotion() {}
+        LinearMotion(shared_ptr<Corporeal> obj, const Vec3& displacement, double time0, double time1)
+            : object(obj), displacement(displacement), time0(time0), time1(time1) {};
+
+        virtual bool hit(const Ray& r, double tMin, double tMax, HitRecord& rec) const override;
+        virtual bool boundingBox(double time0, double time1, AABB& outputBox) const override;
+
+        // Offset of the object from its original position at time t.
+        Vec3 offset(double time) const {
+            if (time1 == time0) return Vec3(0,0,0);
+            return clamp((time - time0) / (time1 - time0), 0.0, 1.0) * displacement;
+        }
+
+    public:
+        shared_ptr<Corporeal> object;
+        Vec3 displacement;
+        double time0, time1;
+};
+
+bool LinearMotion::hit(const Ray& r, double tMin, double tMax, HitRecord& rec) const {
+    // Shift the ray back into the space the object was built in.
+    Vec3 moved = offset(r.time());
+    Ray movedRay(r.origin() - moved, r.direction(), r.time());
+
+    if (!object->hit(movedRay, tMin, tMax, rec)) return false;
+
+    // The object has to finish its hit in the moved space, before the point is moved back. Doing it here instead of
+    //  deferring it means moving objects still pay for it on hits that get discarded.
+    rec.finish(movedRay);
+    // And shift the intersection point forward to where the object actually is at this time.
+    rec.p += moved;
+    return true;
+}
+
+bool LinearMotion::boundingBox(double time0, double time1, AABB& outputBox) const {
+    AABB objectBox;
+    if (!object->boundingBox(time0, time1, objectBox)) return false;
+
+    // The box at either end of the asked interval, the motion is linear so everything in between is covered by both.
+    AABB boxStart(objectBox.min() + offset(time0), objectBox.max() + offset(time0));
+    AABB boxEnd(objectBox.min() + offset(time1), objectBox.max() + offset(time1));
+    outputBox = surroundingBox(boxStart, boxEnd);
+    return true;
+}
+
+#endif
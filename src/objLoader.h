@@ -0,0 +1,394 @@
+#ifndef OBJ_LOADER_H
+#define OBJ_LOADER_H
+
+#include "tracer.h"
+#include "corporealList.h"
+#include "material.h"
+#include "triangleMesh.h"
+#include "mappedFile.h"
+
+#include <algorithm>
+#include <cstdint>
+#include <map>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+/**
+ * Wavefront OBJ (+ MTL) loading. The file is memory mapped and cut into chunks at line boundaries, which are parsed
+ * by one thread each straight out of the mapping. Each chunk collects its vertex attributes and triangulated faces in
+ * flat arrays, and the chunks are then stitched together into one TriangleMesh per material.
+ */
+
+// Chunks smaller than this are not worth a thread of their own.
+const size_t objMinChunkBytes = 1 << 20;
+
+/**
+ * One corner of a triangle: indices into the position, texture coordinate and normal lists, -1 if missing.
+ * Negative OBJ indices count back from the last vertex read so far, which a chunk only knows relative to its own
+ * start. Those are stored as an offset from the chunk's first vertex, negative if they reach back into earlier
+ * chunks, with their bit set in `relative` until the chunks are stitched together.
+ */
+struct ObjCorner {
+    int32_t v, vt, vn;
+    uint8_t relative;
+};
+
+// Bits of ObjCorner::relative.
+const uint8_t objRelativeV = 1, objRelativeVt = 2, objRelativeVn = 4;
+
+// Where a chunk switches to another material with `usemtl`. The name points into the mapped file.
+struct ObjMaterialSwitch {
+    size_t triangle;
+    const char* name;
+    size_t length;
+};
+
+struct ObjChunk {
+    std::vector<float> positions;
+    std::vector<float> texcoords;
+    std::vector<float> normals;
+    // Three corners per triangle, polygons are triangulated as a fan while parsing.
+    std::vector<ObjCorner> corners;
+    std::vector<ObjMaterialSwitch> materialSwitches;
+    const char* mtllib = nullptr;
+    size_t mtllibLength = 0;
+    bool hasTexcoords = false;
+    bool hasNormals = false;
+};
+
+// Turns a 1-based or negative OBJ index into the form described at ObjCorner, 0 isn't an index and becomes missing.
+inline int32_t objIndex(long index, size_t chunkCount, uint8_t& relative, uint8_t bit) {
+    if (index > 0) return (int32_t)std::min<long>(index - 1, INT32_MAX);
+    if (index == 0) return -1;
+    relative |= bit;
+    return (int32_t)std::max<long>((long)chunkCount + index, INT32_MIN);
+}
+
+// Makes a relative index absolute once the chunk's first vertex is known, one before the first vertex is missing.
+inline int32_t resolveObjIndex(int32_t index, size_t chunkBase, bool relative) {
+    if (!relative) return index;
+    long resolved = (long)chunkBase + index;
+    return resolved >= 0 && resolved <= INT32_MAX ? (int32_t)resolved : -1;
+}
+
+void parseObjChunk(const char* p, const char* end, ObjChunk& chunk) {
+    // Reused for every face so polygons don't allocate.
+    std::vector<ObjCorner> polygon;
+    double x, y, z;
+
+    while (p < end) {
+        skipSpaces(p, end);
+        if (p >= end) break;
+
+        if (*p == 'v') {
+            if (matchKeyword(p, end, "v")) {
+                if (parseDouble(p, end, x) && parseDouble(p, end, y) && parseDouble(p, end, z)) {
+                    chunk.positions.push_back((float)x);
+                    chunk.positions.push_back((float)y);
+                    chunk.positions.push_back((float)z);
+                }
+            } else if (matchKeyword(p, end, "vt")) {
+                if (parseDouble(p, end, x)) {
+                    if (!parseDouble(p, end, y)) y = 0;
+                    chunk.texcoords.push_back((float)x);
+                    chunk.texcoords.push_back((float)y);
+                }
+            } else if (matchKeyword(p, end, "vn")) {
+                if (parseDouble(p, end, x) && parseDouble(p, end, y) && parseDouble(p, end, z)) {
+                    chunk.normals.push_back((float)x);
+                    chunk.normals.push_back((float)y);
+                    chunk.normals.push_back((float)z);
+                }
+            }
+        } else if (*p == 'f' && matchKeyword(p, end, "f")) {
+            // Corners look like v, v/vt, v//vn or v/vt/vn.
+            polygon.clear();
+            long index;
+            while (parseInt(p, end, index)) {
+                ObjCorner corner = { -1, -1, -1, 0 };
+                corner.v = objIndex(index, chunk.positions.size() / 3, corner.relative, objRelativeV);
+                if (p < end && *p == '/') {
+                    p++;
+                    if (p < end && *p != '/' && parseInt(p, end, index)) {
+                        corner.vt = objIndex(index, chunk.texcoords.size() / 2, corner.relative, objRelativeVt);
+                        chunk.hasTexcoords = true;
+                    }
+                    if (p < end && *p == '/') {
+                        p++;
+                        if (parseInt(p, end, index)) {
+                            corner.vn = objIndex(index, chunk.normals.size() / 3, corner.relative, objRelativeVn);
+                            chunk.hasNormals = true;
+                        }
+                    }
+                }
+                polygon.push_back(corner);
+            }
+            for (size_t k = 1; k + 1 < polygon.size(); k++) {
+                chunk.corners.push_back(polygon[0]);
+                chunk.corners.push_back(polygon[k]);
+                chunk.corners.push_back(polygon[k + 1]);
+            }
+        } else if (*p == 'u' && matchKeyword(p, end, "usemtl")) {
+            ObjMaterialSwitch materialSwitch;
+            materialSwitch.triangle = chunk.corners.size() / 3;
+            materialSwitch.length = parseWord(p, end, materialSwitch.name);
+            chunk.materialSwitches.push_back(materialSwitch);
+        } else if (*p == 'm' && matchKeyword(p, end, "mtllib")) {
+            chunk.mtllibLength = parseWord(p, end, chunk.mtllib);
+        }
+
+        skipLine(p, end);
+    }
+}
+
+// Reads the materials of an MTL file and maps them onto the closest material this tracer has.
+std::map<std::string, shared_ptr<Material>> loadMtl(const std::string& filename) {
+    std::map<std::string, shared_ptr<Material>> materials;
+    MappedFile file(filename.c_str());
+    if (!file.valid()) return materials;
+
+    std::string directory = filename.substr(0, filename.find_last_of('/') + 1);
+    const char* p = file.data();
+    const char* end = file.end();
+
+    // Properties of the material currently being read, turned into a Material at the next `newmtl` or the end.
+    std::string name;
+    Color kd(0.7, 0.7, 0.7), ks(0, 0, 0), ke(0, 0, 0);
+    double ns = 0, ni = 1.5, opacity = 1;
+    long illum = 2;
+    std::string diffuseMap;
+
+    auto finishMaterial = [&]() {
+        if (name.empty()) return;
+        shared_ptr<Material> mat;
+        if (ke.x() > 0 || ke.y() > 0 || ke.z() > 0) {
+            mat = make_shared<DiffuseLight>(ke);
+        } else if (illum == 4 || illum == 6 || illum == 7 || opacity < 1) {
+            mat = make_shared<Dielectric>(ni);
+        } else if (illum == 3 || illum == 5) {
+            // Translate the Phong exponent into a fuzz, a high exponent is a sharp reflection.
+            mat = make_shared<Metal>(ks, clamp(sqrt(2.0 / (ns + 2.0)), 0.0, 1.0));
+        } else if (!diffuseMap.empty()) {
+            mat = make_shared<Lambertian>(make_shared<ImageTexture>((directory + diffuseMap).c_str()));
+        } else {
+            mat = make_shared<Lambertian>(kd);
+        }
+        materials[name] = mat;
+    };
+
+    while (p < end) {
+        skipSpaces(p, end);
+        const char* word;
+        double r, g, b;
+
+        if (matchKeyword(p, end, "newmtl")) {
+            finishMaterial();
+            size_t length = parseWord(p, end, word);
+            name.assign(word, length);
+            kd = Color(0.7, 0.7, 0.7); ks = Color(0, 0, 0); ke = Color(0, 0, 0);
+            ns = 0; ni = 1.5; opacity = 1; illum = 2;
+            diffuseMap.clear();
+        } else if (matchKeyword(p, end, "Kd")) {
+            if (parseDouble(p, end, r) && parseDouble(p, end, g) && parseDouble(p, end, b)) kd = Color(r, g, b);
+        } else if (matchKeyword(p, end, "Ks")) {
+            if (parseDouble(p, end, r) && parseDouble(p, end, g) && parseDouble(p, end, b)) ks = Color(r, g, b);
+        } else if (matchKeyword(p, end, "Ke")) {
+            if (parseDouble(p, end, r) && parseDouble(p, end, g) && parseDouble(p, end, b)) ke = Color(r, g, b);
+        } else if (matchKeyword(p, end, "Ns")) {
+            parseDouble(p, end, ns);
+        } else if (matchKeyword(p, end, "Ni")) {
+            parseDouble(p, end, ni);
+        } else if (matchKeyword(p, end, "d")) {
+            parseDouble(p, end, opacity);
+        } else if (matchKeyword(p, end, "Tr")) {
+            if (parseDouble(p, end, r)) opacity = 1 - r;
+        } else if (matchKeyword(p, end, "illum")) {
+            parseInt(p, end, illum);
+        } else if (matchKeyword(p, end, "map_Kd")) {
+            size_t length = parseWord(p, end, word);
+            diffuseMap.assign(word, length);
+        }
+
+        skipLine(p, end);
+    }
+    finishMaterial();
+
+    return materials;
+}
+
+// Hashes the attribute indices of a corner, to find corners that can share one mesh vertex.
+struct ObjCornerHash {
+    size_t operator()(const ObjCorner& c) const {
+        return ((size_t)c.v * 73856093u) ^ ((size_t)(c.vt + 1) * 19349663u) ^ ((size_t)(c.vn + 1) * 83492791u);
+    }
+};
+
+struct ObjCornerEqual {
+    bool operator()(const ObjCorner& a, const ObjCorner& b) const {
+        return a.v == b.v && a.vt == b.vt && a.vn == b.vn;
+    }
+};
+
+/**
+ * Builds one TriangleMesh out of the given triangles. OBJ indexes every attribute separately while a mesh has one
+ * index per vertex, so every distinct position/texcoord/normal combination becomes a vertex. Without texcoords and
+ * normals the positions can be used as they are.
+ */
+shared_ptr<TriangleMesh> buildObjMesh(
+    const std::vector<const ObjCorner*>& triangles, const std::vector<float>& positions,
+    const std::vector<float>& texcoords, const std::vector<float>& normals, shared_ptr<Material> mat) {
+    bool useTexcoords = !texcoords.empty();
+    bool useNormals = !normals.empty();
+    int32_t vertexCount = (int32_t)(positions.size() / 3);
+
+    std::vector<float> meshPositions, meshNormals, meshUvs;
+    std::vector<uint32_t> indices;
+    indices.reserve(3 * triangles.size());
+
+    std::vector<uint32_t> positionRemap;
+    std::unordered_map<ObjCorner, uint32_t, ObjCornerHash, ObjCornerEqual> cornerRemap;
+    if (!useTexcoords && !useNormals) positionRemap.assign(vertexCount, UINT32_MAX);
+
+    for (auto triangle : triangles) {
+        // Skip faces that point at vertices that don't exist rather than reading out of bounds.
+        if (triangle[0].v < 0 || triangle[0].v >= vertexCount || triangle[1].v < 0 || triangle[1].v >= vertexCount
+            || triangle[2].v < 0 || triangle[2].v >= vertexCount) continue;
+
+        for (int k = 0; k < 3; k++) {
+            ObjCorner corner = triangle[k];
+            if (!useTexcoords || corner.vt < 0 || 2 * (size_t)corner.vt >= texcoords.size()) corner.vt = -1;
+            if (!useNormals || corner.vn < 0 || 3 * (size_t)corner.vn >= normals.size()) corner.vn = -1;
+
+            uint32_t* slot;
+            if (!positionRemap.empty()) {
+                slot = &positionRemap[corner.v];
+            } else {
+                auto inserted = cornerRemap.insert(std::make_pair(corner, UINT32_MAX));
+                slot = &inserted.first->second;
+            }
+
+            if (*slot == UINT32_MAX) {
+                *slot = (uint32_t)(meshPositions.size() / 3);
+                meshPositions.insert(meshPositions.end(), &positions[3 * corner.v], &positions[3 * corner.v] + 3);
+                if (useNormals) {
+                    if (corner.vn >= 0) meshNormals.insert(meshNormals.end(), &normals[3 * corner.vn], &normals[3 * corner.vn] + 3);
+                    else meshNormals.insert(meshNormals.end(), { 0.0f, 0.0f, 0.0f });
+                }
+                if (useTexcoords) {
+                    if (corner.vt >= 0) meshUvs.insert(meshUvs.end(), &texcoords[2 * corner.vt], &texcoords[2 * corner.vt] + 2);
+                    else meshUvs.insert(meshUvs.end(), { 0.0f, 0.0f });
+                }
+            }
+            indices.push_back(*slot);
+        }
+    }
+
+    return make_shared<TriangleMesh>(std::move(meshPositions), std::move(indices), mat, std::move(meshNormals), std::move(meshUvs));
+}
+
+/**
+ * Loads an OBJ file and adds a TriangleMesh per material to `meshes`. If `material` is given every face gets it and
+ * the MTL file is ignored. Returns false if the file can't be read.
+ */
+bool loadObj(const char* filename, CorporealList& meshes, shared_ptr<Material> material = nullptr) {
+    MappedFile file(filename);
+    if (!file.valid()) {
+        std::cerr << "ERROR: Could not load OBJ file '" << filename << "'.\n";
+        return false;
+    }
+
+    // Cut the file into chunks, moving every cut to the start of the next line.
+    size_t threadCount = std::max<size_t>(1, std::thread::hardware_concurrency());
+    threadCount = std::max<size_t>(1, std::min(threadCount, file.size() / objMinChunkBytes));
+    std::vector<const char*> cuts(threadCount + 1);
+    cuts[0] = file.data();
+    cuts[threadCount] = file.end();
+    for (size_t i = 1; i < threadCount; i++) {
+        const char* cut = std::max(cuts[i - 1], file.data() + i * (file.size() / threadCount));
+        if (cut > file.data() && cut[-1] != '\n') skipLine(cut, file.end());
+        cuts[i] = cut;
+    }
+
+    std::vector<ObjChunk> chunks(threadCount);
+    std::vector<std::thread> workers;
+    for (size_t i = 0; i < threadCount; i++) {
+        workers.emplace_back(parseObjChunk, cuts[i], cuts[i + 1], std::ref(chunks[i]));
+    }
+    for (auto& worker : workers) worker.join();
+
+    // Stitch the attribute lists together in file order.
+    std::vector<float> positions, texcoords, normals;
+    std::vector<size_t> positionBase(threadCount), texcoordBase(threadCount), normalBase(threadCount);
+    bool hasTexcoords = false, hasNormals = false;
+    for (size_t i = 0; i < threadCount; i++) {
+        positionBase[i] = positions.size() / 3;
+        texcoordBase[i] = texcoords.size() / 2;
+        normalBase[i] = normals.size() / 3;
+        positions.insert(positions.end(), chunks[i].positions.begin(), chunks[i].positions.end());
+        texcoords.insert(texcoords.end(), chunks[i].texcoords.begin(), chunks[i].texcoords.end());
+        normals.insert(normals.end(), chunks[i].normals.begin(), chunks[i].normals.end());
+        std::vector<float>().swap(chunks[i].positions);
+        std::vector<float>().swap(chunks[i].texcoords);
+        std::vector<float>().swap(chunks[i].normals);
+        hasTexcoords = hasTexcoords || chunks[i].hasTexcoords;
+        hasNormals = hasNormals || chunks[i].hasNormals;
+    }
+    if (!hasTexcoords) texcoords.clear();
+    if (!hasNormals) normals.clear();
+
+    // Now that every chunk knows where its vertices ended up, relative indices can be made absolute.
+    workers.clear();
+    for (size_t i = 0; i < threadCount; i++) {
+        workers.emplace_back([&chunks, &positionBase, &texcoordBase, &normalBase, i]() {
+            for (auto& corner : chunks[i].corners) {
+                corner.v = resolveObjIndex(corner.v, positionBase[i], corner.relative & objRelativeV);
+                corner.vt = resolveObjIndex(corner.vt, texcoordBase[i], corner.relative & objRelativeVt);
+                corner.vn = resolveObjIndex(corner.vn, normalBase[i], corner.relative & objRelativeVn);
+                corner.relative = 0;
+            }
+        });
+    }
+    for (auto& worker : workers) worker.join();
+
+    std::map<std::string, shared_ptr<Material>> materials;
+    if (!material) {
+        for (const auto& chunk : chunks) {
+            if (!chunk.mtllib) continue;
+            std::string name(filename);
+            name = name.substr(0, name.find_last_of('/') + 1) + std::string(chunk.mtllib, chunk.mtllibLength);
+            materials = loadMtl(name);
+            break;
+        }
+    }
+
+    // Group the triangles by material. A `usemtl` stays active across chunk boundaries.
+    std::map<std::string, std::vector<const ObjCorner*>> groups;
+    std::string current;
+    for (const auto& chunk : chunks) {
+        size_t nextSwitch = 0;
+        for (size_t t = 0; t < chunk.corners.size() / 3; t++) {
+            while (nextSwitch < chunk.materialSwitches.size() && chunk.materialSwitches[nextSwitch].triangle == t) {
+                current.assign(chunk.materialSwitches[nextSwitch].name, chunk.materialSwitches[nextSwitch].length);
+                nextSwitch++;
+            }
+            groups[material ? std::string() : current].push_back(&chunk.corners[3 * t]);
+        }
+        // Switches after the chunk's last face hold for the faces of the next chunks.
+        for (; nextSwitch < chunk.materialSwitches.size(); nextSwitch++) {
+            current.assign(chunk.materialSwitches[nextSwitch].name, chunk.materialSwitches[nextSwitch].length);
+        }
+    }
+
+    auto defaultMat = material ? material : make_shared<Lambertian>(Color(0.7, 0.7, 0.7));
+    for (const auto& group : groups) {
+        auto found = materials.find(group.first);
+        auto mat = found != materials.end() ? found->second : defaultMat;
+        meshes.add(buildObjMesh(group.second, positions, texcoords, normals, mat));
+    }
+
+    return true;
+}
+
+#endif
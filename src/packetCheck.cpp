@@ -0,0 +1,94 @@
+// Checks that tracing rays as packets finds exactly what tracing them one at a time finds: the packet box test may let
+//  extra rays through, but never drop one the double precision test keeps, and the closest hits have to agree. Prints
+//  the mismatches per scene and exits with 1 if there are any.
+//
+//     g++ -std=c++11 -O2 -mavx2 src/packetCheck.cpp -o packetCheck && ./packetCheck
+
+#include "tracer.h"
+#include "corporealList.h"
+#include "bvh.h"
+#include "sphere.h"
+#include "box.h"
+
+#include <iostream>
+
+int failures = 0;
+
+/**
+ * Shoots packets of eight neighbouring rays from around `eye` through a `spread` wide patch around `target`, and
+ * compares the packet traversal of `world` and the packet test of `box` against the single ray versions.
+ */
+void check(const char* name, const Corporeal& world, const AABB& box, const Point3& eye, const Point3& target,
+    double spread, int packets) {
+    Vec3 forward = target - eye;
+    Vec3 right = spread * unitVector(cross(forward, Vec3(0, 1, 0)));
+    Vec3 up = spread * unitVector(cross(right, forward));
+    uint64_t rays = 0, worldMismatches = 0, boxHits = 0, boxCulled = 0;
+
+    for (int n = 0; n < packets; n++) {
+        RayPacket packet;
+        PacketHits hits;
+        double u = randomDouble(-1, 1), v = randomDouble(-1, 1);
+        for (int k = 0; k < packetSize; k++) {
+            Point3 origin = eye + Vec3::random(-0.01, 0.01);
+            Vec3 direction = target + (u + k * 1e-3) * right + v * up - origin;
+            packet.add(Ray(origin, direction));
+            hits.tMax[k] = infinity;
+        }
+
+        double boxFar[packetSize];
+        for (int k = 0; k < packetSize; k++) boxFar[k] = infinity;
+        uint32_t boxMask = box.hit(packet, packet.allRays(), 0.001, boxFar);
+        world.hitPacket(packet, packet.allRays(), 0.001, hits);
+
+        for (int k = 0; k < packetSize; k++) {
+            rays++;
+            if (box.hit(packet.rays[k], 0.001, infinity)) {
+                boxHits++;
+                if (!(boxMask & (1u << k))) boxCulled++;
+            }
+            HitRecord rec;
+            bool single = world.hit(packet.rays[k], 0.001, infinity, rec);
+            bool packed = (hits.hitMask & (1u << k)) != 0;
+            if (single != packed || (single && rec.t != hits.rec[k].t)) worldMismatches++;
+        }
+    }
+
+    std::cout << name << ": " << rays << " rays, " << worldMismatches << " traced differently, " << boxCulled << " of "
+              << boxHits << " box hits culled by the packet test\n";
+    if (worldMismatches > 0 || boxCulled > 0) {
+        std::cerr << "ERROR: Packets and single rays disagree in '" << name << "'.\n";
+        failures++;
+    }
+}
+
+int main() {
+    auto mat = make_shared<Lambertian>(Color(0.5, 0.5, 0.5));
+
+    // Spheres of all sizes around the origin.
+    CorporealList spheres;
+    for (int i = 0; i < 500; i++) spheres.add(make_shared<Sphere>(Vec3::random(-10, 10), randomDouble(0.05, 1), mat));
+    BvhNode sphereTree(spheres, 0, 1);
+    AABB sphereBounds;
+    sphereTree.boundingBox(0, 1, sphereBounds);
+    check("spheres near the origin", sphereTree, sphereBounds, Point3(0, 2, 30), Point3(0, 0, 0), 12, 100000);
+
+    // Thin boxes far from the origin, where float rounding of the coordinates is larger than the boxes' thickness.
+    CorporealList boxes;
+    Point3 far(1e4, 50, -1e4);
+    for (int i = 0; i < 200; i++) {
+        Point3 corner = far + Vec3::random(-20, 20);
+        boxes.add(make_shared<Box>(corner, corner + Vec3(randomDouble(1, 5), 1e-3, randomDouble(1, 5)), mat));
+    }
+    BvhNode boxTree(boxes, 0, 1);
+    Point3 slab = far + Vec3(0, 0.3, 0);
+    AABB thinBox(slab - Vec3(30, 1e-3, 30), slab + Vec3(30, 1e-3, 30));
+    check("thin boxes 10000 units out", boxTree, thinBox, far + Vec3(-40, 15, -40), far, 25, 200000);
+
+    if (failures > 0) {
+        std::cerr << "ERROR: " << failures << " checks failed.\n";
+        return 1;
+    }
+    std::cout << "All checks passed.\n";
+    return 0;
+}
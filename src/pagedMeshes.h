@@ -0,0 +1,216 @@
+#ifndef PAGED_MESHES_H
+#define PAGED_MESHES_H
+
+#include "tracer.h"
+#include "corporeal.h"
+#include "corporealList.h"
+#include "flatBvh.h"
+#include "triangleMesh.h"
+#include "mappedFile.h"
+#include "meshCache.h"
+#include "geometryCache.h"
+
+#include <cstdint>
+#include <iostream>
+#include <unordered_map>
+#include <vector>
+
+#include <sys/resource.h>
+
+// A hit is stored as cluster << clusterShift | triangle, so a cluster holds at most this many triangles.
+const uint32_t clusterShift = 16;
+const uint32_t maxClusterSize = 1u << clusterShift;
+
+/**
+ * Cuts every TriangleMesh in `meshes` into clusters of at most `clusterSize` triangles lying close together, and
+ * writes them as a mesh cache with one entry per cluster, ready for PagedMeshSet. The clusters are the leaves of a
+ * FlatBvh built with that leaf size, so they hold between half and all of it. Returns false if the file can't be
+ * written.
+ */
+bool writeMeshClusters(const char* filename, const CorporealList& meshes, uint32_t clusterSize = 4096) {
+    clusterSize = std::min(std::max(clusterSize, 1u), maxClusterSize - 1);
+    CorporealList clusters;
+    for (const auto& object : meshes.objects) {
+        auto mesh = dynamic_cast<const TriangleMesh*>(object.get());
+        if (!mesh) {
+            std::cerr << "WARNING: Cluster file '" << filename << "' skips an object that is no TriangleMesh.\n";
+            continue;
+        }
+
+        std::vector<AABB> bounds(mesh->triangleCount());
+        for (uint32_t i = 0; i < bounds.size(); i++) bounds[i] = mesh->triangleBounds(i);
+        FlatBvh split;
+        split.build(bounds, clusterSize);
+
+        for (size_t n = 0; n < split.nodes.size(); n++) {
+            const FlatBvhNode& node = split.nodes[n];
+            if (node.count == 0) continue;
+
+            // Only the vertices the cluster uses, renumbered.
+            std::vector<float> positions, normals, uvs;
+            std::vector<uint32_t> indices;
+            std::unordered_map<uint32_t, uint32_t> remap;
+            for (uint32_t k = node.offset; k < node.offset + node.count; k++) {
+                uint32_t triangle = split.primIndices[k];
+                for (int corner = 0; corner < 3; corner++) {
+                    uint32_t v = mesh->indices[3*triangle + corner];
+                    auto inserted = remap.insert(std::make_pair(v, (uint32_t)remap.size()));
+                    if (inserted.second) {
+                        for (int a = 0; a < 3; a++) positions.push_back(mesh->positions[3*v + a]);
+                        if (!mesh->normals.empty()) for (int a = 0; a < 3; a++) normals.push_back(mesh->normals[3*v + a]);
+                        if (!mesh->uvs.empty()) for (int a = 0; a < 2; a++) uvs.push_back(mesh->uvs[2*v + a]);
+                    }
+                    indices.push_back(inserted.first->second);
+                }
+            }
+            clusters.add(make_shared<TriangleMesh>(std::move(positions), std::move(indices), mesh->matPtr,
+                                                   std::move(normals), std::move(uvs)));
+        }
+    }
+    return writeMeshCache(filename, clusters);
+}
+
+/**
+ * Geometry that doesn't have to fit in memory. The meshes live as clusters in a file written by writeMeshClusters,
+ * which is mapped but not read up front. Only the cluster table and a BVH over the cluster bounds stay resident. A
+ * cluster is paged in the first time a ray reaches its box: its arrays are used in place from the mapping and its
+ * mesh is put in a GeometryCache, which holds the clusters in use to `budgetBytes`. An evicted cluster gives its pages
+ * back to the kernel and is paged in again when it is next needed.
+ */
+class PagedMeshSet : public Corporeal {
+    public:
+        // `file` must have passed openMeshCache.
+        PagedMeshSet(shared_ptr<MappedFile> file, shared_ptr<Material> mat, size_t budgetBytes);
+
+        virtual bool hit(const Ray& r, double tMin, double tMax, HitRecord& rec) const override;
+        virtual bool boundingBox(double time0, double time1, AABB& outputBox) const override;
+        virtual void finishHit(const Ray& r, HitRecord& rec) const override;
+
+        size_t clusterCount() const { return clusterBytes.size(); }
+        // Prints how often clusters were paged in and reused, and what they take.
+        void report(std::ostream& out) const;
+
+    public:
+        shared_ptr<MappedFile> file;
+        shared_ptr<Material> matPtr;
+        mutable GeometryCache cache;
+        // Over the cluster bounds, stays resident.
+        FlatBvh bvh;
+        // Where each cluster's arrays start in the file and how many bytes they span.
+        std::vector<uint64_t> clusterOffsets;
+        std::vector<uint64_t> clusterBytes;
+
+    private:
+        shared_ptr<const TriangleMesh> cluster(uint32_t index) const;
+};
+
+/**
+ * Keeps the mapping alive for the meshes of a paged in cluster. When the last one is gone (evicted, and no thread is
+ * still using it) the cluster's pages are released.
+ */
+struct ClusterPages {
+    ClusterPages(shared_ptr<MappedFile> file, uint64_t offset, uint64_t bytes) : file(file), offset(offset), bytes(bytes) {}
+    ~ClusterPages() { file->release(offset, bytes); }
+
+    shared_ptr<MappedFile> file;
+    uint64_t offset, bytes;
+};
+
+PagedMeshSet::PagedMeshSet(shared_ptr<MappedFile> file, shared_ptr<Material> mat, size_t budgetBytes)
+    : file(file), matPtr(mat), cache(budgetBytes) {
+    uint64_t count = meshCacheCount(*file);
+    std::vector<AABB> bounds(count);
+    clusterOffsets.resize(count);
+    clusterBytes.resize(count);
+    for (uint64_t i = 0; i < count; i++) {
+        const MeshCacheEntry& entry = meshCacheEntry(*file, i);
+        bounds[i] = AABB(Point3(entry.boundsMin[0], entry.boundsMin[1], entry.boundsMin[2]),
+                         Point3(entry.boundsMax[0], entry.boundsMax[1], entry.boundsMax[2]));
+
+        // writeMeshCache puts a mesh's arrays one after the other.
+        uint64_t first = UINT64_MAX, last = 0;
+        const MeshCacheArray* arrays[7] = { &entry.positions, &entry.normals, &entry.uvs, &entry.indices, &entry.bvhNodes,
+                                            &entry.bvhPrimIndices, &entry.packedVertices };
+        const uint64_t elementSizes[7] = { sizeof(float), sizeof(float), sizeof(float), sizeof(uint32_t), sizeof(FlatBvhNode),
+                                           sizeof(uint32_t), sizeof(float) };
+        for (int k = 0; k < 7; k++) {
+            if (arrays[k]->count == 0) continue;
+            first = std::min(first, arrays[k]->offset);
+            last = std::max(last, arrays[k]->offset + arrays[k]->count * elementSizes[k]);
+        }
+        clusterOffsets[i] = last > first ? first : 0;
+        clusterBytes[i] = last > first ? last - first : 0;
+    }
+    bvh.build(bounds, 1);
+    // Clusters are read in no particular order, reading ahead would only page in neighbours that aren't needed.
+    file->advise(MADV_RANDOM);
+}
+
+shared_ptr<const TriangleMesh> PagedMeshSet::cluster(uint32_t index) const {
+    return cache.get(GeometryKey{ this, index }, [this, index]() {
+        auto pages = make_shared<ClusterPages>(file, clusterOffsets[index], clusterBytes[index]);
+        return meshFromCacheEntry(*file, meshCacheEntry(*file, index), matPtr, pages);
+    }, clusterBytes[index]);
+}
+
+bool PagedMeshSet::boundingBox(double time0, double time1, AABB& outputBox) const {
+    if (bvh.empty()) return false;
+    outputBox = bvh.bounds();
+    return true;
+}
+
+bool PagedMeshSet::hit(const Ray& r, double tMin, double tMax, HitRecord& rec) const {
+    return bvh.hit(r, tMin, tMax, [this, &r, &rec](uint32_t index, double tMin, double& closest) {
+        shared_ptr<const TriangleMesh> mesh = cluster(index);
+        if (!mesh->hit(r, tMin, closest, rec)) return false;
+        closest = rec.t;
+        // The cluster may be evicted before the hit is finished, remember where to find the triangle instead.
+        rec.primitive = index << clusterShift | rec.primitive;
+        rec.object = this;
+        return true;
+    });
+}
+
+void PagedMeshSet::finishHit(const Ray& r, HitRecord& rec) const {
+    shared_ptr<const TriangleMesh> mesh = cluster(rec.primitive >> clusterShift);
+    mesh->fillHit(rec.primitive & (maxClusterSize - 1), r, rec.t, 1.0 - rec.b1 - rec.b2, rec.b1, rec.b2, rec);
+}
+
+void PagedMeshSet::report(std::ostream& out) const {
+    uint64_t pagedIn = cache.buildCount(), reused = cache.hitCount();
+    uint64_t total = 0;
+    for (uint64_t bytes : clusterBytes) total += bytes;
+    struct rusage usage;
+    getrusage(RUSAGE_SELF, &usage);
+
+    out << "Paged geometry: " << clusterCount() << " clusters, " << total / (1024 * 1024) << " MiB on disk, budget "
+        << cache.budgetBytes / (1024 * 1024) << " MiB\n";
+    out << "  paged in " << pagedIn << " times, reused " << reused << " times ("
+        << (pagedIn + reused > 0 ? 100.0 * reused / (pagedIn + reused) : 0.0) << "% reuse), evicted "
+        << cache.evictionCount() << " times\n";
+    out << "  resident " << cache.bytesUsed() / (1024 * 1024) << " MiB in " << cache.entryCount() << " clusters, "
+        << usage.ru_majflt << " major page faults\n";
+}
+
+/**
+ * Opens a file written by writeMeshClusters for paging, with `budgetBytes` for the clusters in use. Returns nullptr
+ * if the file is missing, from another version or damaged.
+ */
+shared_ptr<PagedMeshSet> openPagedMeshes(const char* filename, size_t budgetBytes, shared_ptr<Material> material = nullptr) {
+    shared_ptr<MappedFile> file = openMeshCache(filename);
+    if (!file) return nullptr;
+    if (meshCacheCount(*file) >= (1ull << (32 - clusterShift))) {
+        std::cerr << "ERROR: Cluster file '" << filename << "' has too many clusters.\n";
+        return nullptr;
+    }
+    for (uint64_t i = 0; i < meshCacheCount(*file); i++) {
+        if (meshCacheEntry(*file, i).indices.count / 3 >= maxClusterSize) {
+            std::cerr << "ERROR: Cluster file '" << filename << "' has a cluster that is too big.\n";
+            return nullptr;
+        }
+    }
+    auto mat = material ? material : make_shared<Lambertian>(Color(0.7, 0.7, 0.7));
+    return make_shared<PagedMeshSet>(file, mat, budgetBytes);
+}
+
+#endif
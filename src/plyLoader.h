@@ -0,0 +1,336 @@
+#ifndef PLY_LOADER_H
+#define PLY_LOADER_H
+
+#include "tracer.h"
+#include "corporealList.h"
+#include "material.h"
+#include "triangleMesh.h"
+#include "mappedFile.h"
+
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <string>
+#include <vector>
+
+/**
+ * Binary little endian PLY loading. The file is memory mapped and only the text header is parsed. If the vertices are
+ * nothing but float x, y and z the mesh uses them straight from the mapping, otherwise the wanted properties are
+ * copied out in one strided pass. Faces always take one pass, as every face in a PLY starts with its corner count.
+ */
+
+enum PlyType { PlyInt8, PlyUInt8, PlyInt16, PlyUInt16, PlyInt32, PlyUInt32, PlyFloat32, PlyFloat64, PlyInvalid };
+
+inline size_t plyTypeSize(PlyType type) {
+    switch (type) {
+        case PlyInt8: case PlyUInt8: return 1;
+        case PlyInt16: case PlyUInt16: return 2;
+        case PlyInt32: case PlyUInt32: case PlyFloat32: return 4;
+        case PlyFloat64: return 8;
+        default: return 0;
+    }
+}
+
+// Both the old and the sized type names are in use.
+inline PlyType plyTypeFromName(const char* name, size_t length) {
+    std::string type(name, length);
+    if (type == "char" || type == "int8") return PlyInt8;
+    if (type == "uchar" || type == "uint8") return PlyUInt8;
+    if (type == "short" || type == "int16") return PlyInt16;
+    if (type == "ushort" || type == "uint16") return PlyUInt16;
+    if (type == "int" || type == "int32") return PlyInt32;
+    if (type == "uint" || type == "uint32") return PlyUInt32;
+    if (type == "float" || type == "float32") return PlyFloat32;
+    if (type == "double" || type == "float64") return PlyFloat64;
+    return PlyInvalid;
+}
+
+// Reads a value of the given type. memcpy because nothing in a PLY body is aligned.
+inline double readPlyValue(const char* p, PlyType type) {
+    switch (type) {
+        case PlyInt8:    { int8_t v;   memcpy(&v, p, 1); return v; }
+        case PlyUInt8:   { uint8_t v;  memcpy(&v, p, 1); return v; }
+        case PlyInt16:   { int16_t v;  memcpy(&v, p, 2); return v; }
+        case PlyUInt16:  { uint16_t v; memcpy(&v, p, 2); return v; }
+        case PlyInt32:   { int32_t v;  memcpy(&v, p, 4); return v; }
+        case PlyUInt32:  { uint32_t v; memcpy(&v, p, 4); return v; }
+        case PlyFloat32: { float v;    memcpy(&v, p, 4); return v; }
+        case PlyFloat64: { double v;   memcpy(&v, p, 8); return v; }
+        default: return 0;
+    }
+}
+
+struct PlyProperty {
+    std::string name;
+    PlyType type;
+    // Type of the count in front of a list, PlyInvalid for plain properties.
+    PlyType countType;
+    // Offset within the element, only meaningful if the element has a fixed size.
+    size_t offset;
+};
+
+struct PlyElement {
+    std::string name;
+    size_t count;
+    std::vector<PlyProperty> properties;
+    // Elements without list properties have a fixed size and can be indexed directly.
+    bool fixedSize;
+    size_t stride;
+    // The fewest bytes one element can take, with every list empty.
+    size_t minimumSize;
+
+    int find(const char* propertyName) const {
+        for (size_t i = 0; i < properties.size(); i++) {
+            if (properties[i].name == propertyName) return (int)i;
+        }
+        return -1;
+    }
+};
+
+// Size of one element that may contain lists, read from the data at p. Returns 0 if it would run past `end`.
+size_t plyElementSize(const PlyElement& element, const char* p, const char* end) {
+    if (element.fixedSize) return element.stride;
+    const char* start = p;
+    for (const auto& property : element.properties) {
+        if (property.countType != PlyInvalid) {
+            if (p + plyTypeSize(property.countType) > end) return 0;
+            size_t count = (size_t)readPlyValue(p, property.countType);
+            p += plyTypeSize(property.countType) + count * plyTypeSize(property.type);
+        } else {
+            p += plyTypeSize(property.type);
+        }
+        if (p > end) return 0;
+    }
+    return p - start;
+}
+
+// Parses the header up to and including `end_header`. Moves p to the start of the binary data.
+bool parsePlyHeader(const char*& p, const char* end, std::vector<PlyElement>& elements) {
+    if (!matchKeyword(p, end, "ply")) return false;
+    skipLine(p, end);
+
+    while (p < end) {
+        const char* word;
+        size_t length;
+        skipSpaces(p, end);
+
+        if (matchKeyword(p, end, "format")) {
+            length = parseWord(p, end, word);
+            if (std::string(word, length) != "binary_little_endian") {
+                std::cerr << "ERROR: PLY format '" << std::string(word, length) << "' is not supported, only binary_little_endian.\n";
+                return false;
+            }
+        } else if (matchKeyword(p, end, "element")) {
+            PlyElement element;
+            length = parseWord(p, end, word);
+            element.name.assign(word, length);
+            long count;
+            if (!parseInt(p, end, count) || count < 0) return false;
+            element.count = (size_t)count;
+            element.fixedSize = true;
+            element.stride = 0;
+            element.minimumSize = 0;
+            elements.push_back(element);
+        } else if (matchKeyword(p, end, "property")) {
+            if (elements.empty()) return false;
+            PlyElement& element = elements.back();
+            PlyProperty property;
+            property.countType = PlyInvalid;
+            property.offset = element.stride;
+
+            length = parseWord(p, end, word);
+            if (std::string(word, length) == "list") {
+                length = parseWord(p, end, word);
+                property.countType = plyTypeFromName(word, length);
+                length = parseWord(p, end, word);
+                element.fixedSize = false;
+                if (property.countType == PlyInvalid) return false;
+            }
+            property.type = plyTypeFromName(word, length);
+            if (property.type == PlyInvalid) return false;
+            length = parseWord(p, end, word);
+            property.name.assign(word, length);
+            element.stride += plyTypeSize(property.type);
+            element.minimumSize += plyTypeSize(property.countType != PlyInvalid ? property.countType : property.type);
+            element.properties.push_back(property);
+        } else if (matchKeyword(p, end, "end_header")) {
+            skipLine(p, end);
+            // No element can have more entries than fit in the rest of the file, which also keeps count * size from
+            //  overflowing anywhere below.
+            for (const auto& element : elements) {
+                if (element.minimumSize > 0 && element.count > (size_t)(end - p) / element.minimumSize) return false;
+            }
+            return true;
+        }
+        // comment, obj_info and anything else we don't know are skipped.
+        skipLine(p, end);
+    }
+    return false;
+}
+
+/**
+ * Loads a binary little endian PLY file and adds it to `meshes` as one TriangleMesh. Vertex normals (nx, ny, nz) and
+ * texture coordinates (u/v, s/t or texture_u/texture_v) are used if present. Returns false if the file can't be read.
+ */
+bool loadPly(const char* filename, CorporealList& meshes, shared_ptr<Material> material = nullptr) {
+    auto file = make_shared<MappedFile>(filename);
+    if (!file->valid()) {
+        std::cerr << "ERROR: Could not load PLY file '" << filename << "'.\n";
+        return false;
+    }
+
+    // The data is used as it is in memory, which only works if this machine is little endian too.
+    uint16_t endianTest = 1;
+    if (*reinterpret_cast<uint8_t*>(&endianTest) != 1) {
+        std::cerr << "ERROR: PLY loading needs a little endian machine.\n";
+        return false;
+    }
+
+    const char* p = file->data();
+    const char* end = file->end();
+    std::vector<PlyElement> elements;
+    if (!parsePlyHeader(p, end, elements)) {
+        std::cerr << "ERROR: Could not read the header of PLY file '" << filename << "'.\n";
+        return false;
+    }
+
+    MeshBuffer<float> positions, normals, uvs;
+    std::vector<uint32_t> indices;
+    size_t vertexCount = 0;
+
+    for (const auto& element : elements) {
+        if (element.name == "vertex") {
+            int x = element.find("x"), y = element.find("y"), z = element.find("z");
+            if (!element.fixedSize || x < 0 || y < 0 || z < 0 || element.count > (size_t)(end - p) / element.stride) {
+                std::cerr << "ERROR: PLY file '" << filename << "' has no usable vertex positions.\n";
+                return false;
+            }
+            vertexCount = element.count;
+            const auto& props = element.properties;
+
+            bool packedFloats = element.properties.size() == 3 && x == 0 && y == 1 && z == 2
+                && props[0].type == PlyFloat32 && props[1].type == PlyFloat32 && props[2].type == PlyFloat32;
+            if (packedFloats && reinterpret_cast<uintptr_t>(p) % alignof(float) == 0) {
+                // Exactly the layout TriangleMesh wants: use it in place, the mesh keeps the mapping alive.
+                positions = MeshBuffer<float>(reinterpret_cast<const float*>(p), 3 * vertexCount, file);
+            } else {
+                // Gathers three properties per vertex into a packed float array in one strided pass.
+                auto gather = [&element, p](int a, int b, int c) {
+                    std::vector<float> out(3 * element.count);
+                    const PlyProperty* props[3] = { &element.properties[a], &element.properties[b], &element.properties[c] };
+                    bool allFloats = props[0]->type == PlyFloat32 && props[1]->type == PlyFloat32 && props[2]->type == PlyFloat32;
+                    const char* v = p;
+                    for (size_t i = 0; i < element.count; i++, v += element.stride) {
+                        if (allFloats) {
+                            memcpy(&out[3*i],     v + props[0]->offset, 4);
+                            memcpy(&out[3*i + 1], v + props[1]->offset, 4);
+                            memcpy(&out[3*i + 2], v + props[2]->offset, 4);
+                        } else {
+                            for (int k = 0; k < 3; k++) out[3*i + k] = (float)readPlyValue(v + props[k]->offset, props[k]->type);
+                        }
+                    }
+                    return out;
+                };
+                positions = gather(x, y, z);
+
+                int nx = element.find("nx"), ny = element.find("ny"), nz = element.find("nz");
+                if (nx >= 0 && ny >= 0 && nz >= 0) normals = gather(nx, ny, nz);
+            }
+
+            int u = element.find("u"), v = element.find("v");
+            if (u < 0 || v < 0) { u = element.find("s"); v = element.find("t"); }
+            if (u < 0 || v < 0) { u = element.find("texture_u"); v = element.find("texture_v"); }
+            if (u >= 0 && v >= 0) {
+                std::vector<float> out(2 * element.count);
+                const char* vertex = p;
+                for (size_t i = 0; i < element.count; i++, vertex += element.stride) {
+                    out[2*i]     = (float)readPlyValue(vertex + props[u].offset, props[u].type);
+                    out[2*i + 1] = (float)readPlyValue(vertex + props[v].offset, props[v].type);
+                }
+                uvs = std::move(out);
+            }
+
+            p += element.count * element.stride;
+        } else if (element.name == "face") {
+            int list = element.find("vertex_indices");
+            if (list < 0) list = element.find("vertex_index");
+            if (list < 0 || element.properties[list].countType == PlyInvalid) {
+                std::cerr << "ERROR: PLY file '" << filename << "' has faces without vertex indices.\n";
+                return false;
+            }
+            const PlyProperty& indexList = element.properties[list];
+            size_t countSize = plyTypeSize(indexList.countType);
+            size_t indexSize = plyTypeSize(indexList.type);
+            bool onlyList = element.properties.size() == 1;
+            // Every triangle takes at least one more index in the file, so more than that can't come out of it.
+            indices.reserve(std::min(3 * element.count, 3 * ((size_t)(end - p) / indexSize)));
+
+            for (size_t f = 0; f < element.count; f++) {
+                const char* face = p;
+                size_t faceSize = onlyList ? 0 : plyElementSize(element, p, end);
+                if (!onlyList && faceSize == 0) break;
+
+                // Find the index list within this face, skipping whatever comes before it.
+                for (int k = 0; k < list; k++) {
+                    const PlyProperty& property = element.properties[k];
+                    if (property.countType != PlyInvalid) {
+                        face += plyTypeSize(property.countType) + (size_t)readPlyValue(face, property.countType) * plyTypeSize(property.type);
+                    } else {
+                        face += plyTypeSize(property.type);
+                    }
+                }
+                if (face + countSize > end) break;
+                size_t corners = (size_t)readPlyValue(face, indexList.countType);
+                face += countSize;
+                const char* faceEnd = face + corners * indexSize;
+                if (faceEnd > end) break;
+
+                // Fan triangulation of polygons. A bad index drops the whole face, with the triangles already added for it.
+                size_t faceStart = indices.size();
+                uint32_t first = 0, previous = 0;
+                for (size_t c = 0; c < corners; c++, face += indexSize) {
+                    uint32_t index;
+                    if (indexList.type == PlyInt32 || indexList.type == PlyUInt32) memcpy(&index, face, 4);
+                    else index = (uint32_t)readPlyValue(face, indexList.type);
+                    if (index >= vertexCount) {
+                        indices.resize(faceStart);
+                        break;
+                    }
+
+                    if (c == 0) first = index;
+                    else if (c >= 2) indices.insert(indices.end(), { first, previous, index });
+                    previous = index;
+                }
+
+                p = onlyList ? faceEnd : p + faceSize;
+            }
+        } else {
+            // Anything else is skipped, element by element if it has a variable size.
+            if (element.fixedSize) {
+                if (element.stride > 0 && element.count > (size_t)(end - p) / element.stride) break;
+                p += element.count * element.stride;
+            } else {
+                for (size_t i = 0; i < element.count && p < end; i++) {
+                    size_t size = plyElementSize(element, p, end);
+                    if (size == 0) break;
+                    p += size;
+                }
+            }
+        }
+        if (p > end) break;
+    }
+
+    if (positions.empty() || indices.empty()) {
+        std::cerr << "ERROR: PLY file '" << filename << "' contains no triangles.\n";
+        return false;
+    }
+
+    // In place data gets read in whatever order rays hit it from now on.
+    file->advise(MADV_RANDOM);
+
+    auto mat = material ? material : make_shared<Lambertian>(Color(0.7, 0.7, 0.7));
+    meshes.add(make_shared<TriangleMesh>(positions, std::move(indices), mat, normals, uvs));
+    return true;
+}
+
+#endif
@@ -0,0 +1,100 @@
+#ifndef QUAD_H
+#define QUAD_H
+
+#include "tracer.h"
+#include "corporeal.h"
+#include "aabb.h"
+#include "aarect.h"
+
+/**
+ * A parallelogram in any orientation: the corner `q` and the two edges `u` and `v` leaving it. The front is the side
+ * cross(u, v) points to. Hit points are found as the plane intersection followed by the coordinates along u and v,
+ * which double as the UVs.
+ */
+class Quad : public Corporeal {
+    public:
+        Quad() {}
+        Quad(Point3 q, Vec3 u, Vec3 v, shared_ptr<Material> mat) : q(q), u(u), v(v), matPtr(mat) {
+            // Everything that only depends on the shape, so a hit is two dot products and two cross products.
+            Vec3 n = cross(u, v);
+            normal = unitVector(n);
+            d = dot(normal, q);
+            w = n / dot(n, n);
+            surfaceArea = n.length();
+        }
+
+        virtual bool hit(const Ray& r, double tMin, double tMax, HitRecord& rec) const override;
+        virtual void finishHit(const Ray& r, HitRecord& rec) const override;
+        virtual bool boundingBox(double time0, double time1, AABB& outputBox) const override;
+
+        double area() const { return surfaceArea; }
+        virtual double pdfValue(const Point3& origin, const Vec3& direction) const override {
+            HitRecord rec;
+            if (!hit(Ray(origin, direction), 0.001, infinity, rec)) return 0;
+            return planarPdf(rec.t, direction, normal, surfaceArea);
+        }
+        virtual Vec3 random(const Point3& origin) const override {
+            return q + randomDouble() * u + randomDouble() * v - origin;
+        }
+
+    public:
+        Point3 q;
+        Vec3 u, v;
+        shared_ptr<Material> matPtr;
+        Vec3 normal;
+        // Plane offset: dot(normal, p) == d for every p in the plane.
+        double d;
+        // Projects a point in the plane (relative to q) onto the u and v coordinates.
+        Vec3 w;
+        double surfaceArea;
+};
+
+bool Quad::hit(const Ray& r, double tMin, double tMax, HitRecord& rec) const {
+    double denominator = dot(normal, r.direction());
+    // Parallel to the plane.
+    if (fabs(denominator) < 1e-8) return false;
+
+    double t = (d - dot(normal, r.origin())) / denominator;
+    if (t < tMin || t > tMax) return false;
+
+    Vec3 planar = r.at(t) - q;
+    double alpha = dot(w, cross(planar, v));
+    double beta = dot(w, cross(u, planar));
+    if (alpha < 0 || alpha > 1 || beta < 0 || beta > 1) return false;
+
+    rec.t = t;
+    rec.b1 = alpha;
+    rec.b2 = beta;
+    rec.object = this;
+    return true;
+}
+
+void Quad::finishHit(const Ray& r, HitRecord& rec) const {
+    rec.p = r.at(rec.t);
+    rec.u = rec.b1;
+    rec.v = rec.b2;
+    rec.setFaceNormal(r, normal);
+    rec.matPtr = matPtr;
+}
+
+bool Quad::boundingBox(double time0, double time1, AABB& outputBox) const {
+    Point3 corners[3] = { q + u, q + v, q + u + v };
+    Point3 minPoint = q, maxPoint = q;
+    for (const Point3& corner : corners) {
+        for (int a = 0; a < 3; a++) {
+            minPoint[a] = fmin(minPoint[a], corner[a]);
+            maxPoint[a] = fmax(maxPoint[a], corner[a]);
+        }
+    }
+    // A quad in an axis plane would get a flat box, give it the same thickness the rectangles have.
+    for (int a = 0; a < 3; a++) {
+        if (maxPoint[a] - minPoint[a] < 0.0002) {
+            minPoint[a] -= 0.0001;
+            maxPoint[a] += 0.0001;
+        }
+    }
+    outputBox = AABB(minPoint, maxPoint);
+    return true;
+}
+
+#endif
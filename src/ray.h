@@ -6,11 +6,19 @@
 class Ray {
     public:
         Ray() {}
-        Ray(const Point3& origin, const Vec3& direction) : 
-            orig(origin), dir(direction) {}
+        Ray(const Point3& origin, const Vec3& direction, double time = 0.0) :
+            orig(origin), dir(direction), tm(time) {
+            // Box and slab tests need these at every node a ray visits, so they're worked out once here.
+            for (int a = 0; a < 3; a++) {
+                invDir[a] = 1.0 / dir[a];
+                dirNegative[a] = invDir[a] < 0;
+            }
+        }
 
-        Point3 origin() const { return orig; }
-        Vec3 direction() const { return dir; }
+        const Point3& origin() const { return orig; }
+        const Vec3& direction() const { return dir; }
+        // The moment within the camera shutter interval this ray was sent out at.
+        double time() const { return tm; }
 
         Point3 at(double t) const {
             return orig + t*dir;
@@ -19,6 +27,10 @@ class Ray {
     public:
         Point3 orig;
         Vec3 dir;
+        double tm;
+        // 1 / dir per axis (infinite along axes the ray is parallel to), and whether dir is negative along it.
+        Vec3 invDir;
+        bool dirNegative[3];
 };
 
-#endif
\ No newline at end of file
+#endif
@@ -0,0 +1,62 @@
+#ifndef RAY_PACKET_H
+#define RAY_PACKET_H
+
+#include "tracer.h"
+
+#include <algorithm>
+#include <cstdint>
+
+// Rays traced together, one AVX2 register of floats.
+const int packetSize = 8;
+// With fewer rays than this still in a node, a packet stops sharing work and its rays go on one at a time.
+const int packetMinRays = 3;
+
+/**
+ * Up to `packetSize` coherent rays (like the camera rays of neighbouring pixels), traced through a BVH together so
+ * they share the node fetches. Besides the rays themselves it keeps their origins and inverse directions in lanes for
+ * testing a box against all of them at once, and the range these span over the packet, for throwing away a box none
+ * of them can hit in a single test. Origins stay in double, as rounding them to float could move a ray by more than
+ * the size of a box far from the world origin.
+ */
+struct RayPacket {
+    RayPacket() : count(0), sameSigns(true) {
+        for (int a = 0; a < 3; a++) {
+            for (int i = 0; i < packetSize; i++) origin[a][i] = invDirection[a][i] = 0;
+        }
+    }
+
+    void add(const Ray& r) {
+        int i = count++;
+        rays[i] = r;
+        for (int a = 0; a < 3; a++) {
+            double inv = r.invDir[a];
+            origin[a][i] = r.orig[a];
+            invDirection[a][i] = (float)inv;
+            if (i == 0) {
+                originMin[a] = originMax[a] = r.orig[a];
+                invMin[a] = invMax[a] = inv;
+            } else {
+                originMin[a] = std::min(originMin[a], (double)r.orig[a]);
+                originMax[a] = std::max(originMax[a], (double)r.orig[a]);
+                invMin[a] = std::min(invMin[a], inv);
+                invMax[a] = std::max(invMax[a], inv);
+            }
+            // The range test only holds if every ray goes the same way along every axis.
+            if (!std::isfinite(inv) || (invMin[a] < 0) != (invMax[a] < 0)) sameSigns = false;
+        }
+    }
+
+    // A bit for every ray in the packet.
+    uint32_t allRays() const { return (1u << count) - 1; }
+
+    Ray rays[packetSize];
+    int count;
+    alignas(32) double origin[3][packetSize];
+    alignas(32) float invDirection[3][packetSize];
+    // What the origins and inverse directions span, only usable if sameSigns.
+    bool sameSigns;
+    double originMin[3], originMax[3];
+    double invMin[3], invMax[3];
+};
+
+#endif
@@ -0,0 +1,376 @@
+#ifndef SPARSE_VOLUME_H
+#define SPARSE_VOLUME_H
+
+#include "tracer.h"
+#include "corporeal.h"
+#include "aabb.h"
+#include "material.h"
+#include "densityGrid.h"
+#include "medium.h"
+#include "mappedFile.h"
+
+#include <cstdint>
+#include <cstring>
+#include <fstream>
+#include <vector>
+
+/**
+ * A sparse volume in the spirit of OpenVDB, for smoke that only fills a small part of a large domain. Densities live
+ * in bricks of 8^3 voxels, and only bricks holding any density are stored. Bricks are grouped into blocks of 16^3
+ * bricks, and a dense top level grid points to the blocks that hold any bricks. Memory scales with the occupied
+ * voxels (plus a small table per occupied block), and both levels carry majorants so rays skip empty space a block or
+ * a brick at a time.
+ *
+ * Inside a stored brick the density is interpolated trilinearly between voxel centres. A missing brick is 0
+ * throughout, even right next to a stored one.
+ */
+class SparseVolume {
+    public:
+        static const int brickSize = 8;
+        static const int brickVoxels = brickSize * brickSize * brickSize;
+        // Bricks per side of a block.
+        static const int blockSize = 16;
+        static const int blockBricks = blockSize * blockSize * blockSize;
+        static const int blockVoxels = brickSize * blockSize;
+
+        SparseVolume() {}
+        // A volume of `bricks` bricks per axis starting at `origin`, empty until bricks are added.
+        SparseVolume(const Point3& origin, const Vec3& voxelSize, const int bricks[3]) : origin(origin), voxelSize(voxelSize) {
+            for (int a = 0; a < 3; a++) {
+                blockRes[a] = (bricks[a] + blockSize - 1) / blockSize;
+                brickExtent[a] = voxelSize[a] * brickSize;
+                blockExtent[a] = voxelSize[a] * blockVoxels;
+            }
+            blocks.assign((size_t)blockRes[0] * blockRes[1] * blockRes[2], -1);
+            bounds = AABB(origin, origin + Vec3(bricks[0] * brickExtent[0], bricks[1] * brickExtent[1], bricks[2] * brickExtent[2]));
+        }
+
+        // Stores the 8^3 `values` (x changing fastest) of the brick at brick coordinates x, y, z. Call finalize after.
+        void addBrick(int x, int y, int z, const float* values);
+        // Computes the majorants, needed once all bricks are added.
+        void finalize();
+
+        // Index of a brick in `brickValues`, -1 if it isn't stored.
+        int32_t brickIndex(int x, int y, int z) const {
+            if (x < 0 || y < 0 || z < 0) return -1;
+            int bx = x / blockSize, by = y / blockSize, bz = z / blockSize;
+            if (bx >= blockRes[0] || by >= blockRes[1] || bz >= blockRes[2]) return -1;
+            int32_t block = blocks[((size_t)bz * blockRes[1] + by) * blockRes[0] + bx];
+            if (block < 0) return -1;
+            return brickIndices[(size_t)block * blockBricks + ((z % blockSize) * blockSize + y % blockSize) * blockSize + x % blockSize];
+        }
+
+        // A voxel by its global index, 0 if its brick isn't stored.
+        float voxel(int x, int y, int z) const {
+            int32_t brick = brickIndex(x >> 3, y >> 3, z >> 3);
+            if (brick < 0) return 0;
+            return brickValues[(size_t)brick * brickVoxels + ((z & 7) * brickSize + (y & 7)) * brickSize + (x & 7)];
+        }
+
+        double density(const Point3& p) const;
+
+        /**
+         * Walks the stored bricks the ray passes between t0 and t1 in order and calls `visit(tEnter, tExit, majorant)`
+         * for each, so this can stand in for a MajorantGrid. Missing blocks are crossed in one step of the outer walk,
+         * missing bricks in one step of the inner one.
+         */
+        template <typename Visitor>
+        void traverse(const Ray& r, double t0, double t1, Visitor visit) const;
+
+        size_t brickCount() const { return brickMajorants.size(); }
+        size_t memoryBytes() const {
+            return blocks.size() * sizeof(int32_t) + brickIndices.size() * sizeof(int32_t)
+                 + brickValues.size() * sizeof(float) + (brickMajorants.size() + blockMajorants.size()) * sizeof(float);
+        }
+
+    public:
+        Point3 origin;
+        Vec3 voxelSize;
+        Vec3 brickExtent;
+        Vec3 blockExtent;
+        int blockRes[3] = { 0, 0, 0 };
+        AABB bounds;
+        // Top level: per block its index in `brickIndices` (in units of blockBricks), or -1.
+        std::vector<int32_t> blocks;
+        // Per block blockBricks brick indices, -1 for missing ones.
+        std::vector<int32_t> brickIndices;
+        // brickVoxels values per stored brick.
+        std::vector<float> brickValues;
+        std::vector<float> brickMajorants;
+        std::vector<float> blockMajorants;
+};
+
+void SparseVolume::addBrick(int x, int y, int z, const float* values) {
+    int bx = x / blockSize, by = y / blockSize, bz = z / blockSize;
+    int32_t& block = blocks[((size_t)bz * blockRes[1] + by) * blockRes[0] + bx];
+    if (block < 0) {
+        block = (int32_t)(brickIndices.size() / blockBricks);
+        brickIndices.resize(brickIndices.size() + blockBricks, -1);
+    }
+    int32_t& brick = brickIndices[(size_t)block * blockBricks + ((z % blockSize) * blockSize + y % blockSize) * blockSize + x % blockSize];
+    if (brick < 0) {
+        brick = (int32_t)(brickValues.size() / brickVoxels);
+        brickValues.resize(brickValues.size() + brickVoxels);
+    }
+    memcpy(&brickValues[(size_t)brick * brickVoxels], values, brickVoxels * sizeof(float));
+}
+
+void SparseVolume::finalize() {
+    brickMajorants.assign(brickValues.size() / brickVoxels, 0.0f);
+    blockMajorants.assign(brickIndices.size() / blockBricks, 0.0f);
+
+    for (int bz = 0; bz < blockRes[2]; bz++) {
+        for (int by = 0; by < blockRes[1]; by++) {
+            for (int bx = 0; bx < blockRes[0]; bx++) {
+                int32_t block = blocks[((size_t)bz * blockRes[1] + by) * blockRes[0] + bx];
+                if (block < 0) continue;
+                for (int i = 0; i < blockBricks; i++) {
+                    int32_t brick = brickIndices[(size_t)block * blockBricks + i];
+                    if (brick < 0) continue;
+                    int x = bx * blockSize + i % blockSize;
+                    int y = by * blockSize + (i / blockSize) % blockSize;
+                    int z = bz * blockSize + i / (blockSize * blockSize);
+                    // Interpolation near the edge of the brick also reads the voxels just outside it.
+                    float highest = 0;
+                    for (int vz = z * brickSize - 1; vz <= (z + 1) * brickSize; vz++)
+                        for (int vy = y * brickSize - 1; vy <= (y + 1) * brickSize; vy++)
+                            for (int vx = x * brickSize - 1; vx <= (x + 1) * brickSize; vx++)
+                                highest = std::max(highest, voxel(vx, vy, vz));
+                    brickMajorants[brick] = highest;
+                    blockMajorants[block] = std::max(blockMajorants[block], highest);
+                }
+            }
+        }
+    }
+}
+
+double SparseVolume::density(const Point3& p) const {
+    double g[3];
+    int i[3];
+    for (int a = 0; a < 3; a++) g[a] = (p[a] - origin[a]) / voxelSize[a];
+    // Nothing to interpolate in a missing brick.
+    if (g[0] < 0 || g[1] < 0 || g[2] < 0) return 0;
+    if (brickIndex((int)g[0] >> 3, (int)g[1] >> 3, (int)g[2] >> 3) < 0) return 0;
+
+    // Relative to the centre of voxel 0.
+    for (int a = 0; a < 3; a++) {
+        g[a] -= 0.5;
+        i[a] = (int)floor(g[a]);
+        g[a] -= i[a];
+    }
+    double result = 0;
+    for (int dz = 0; dz < 2; dz++)
+        for (int dy = 0; dy < 2; dy++)
+            for (int dx = 0; dx < 2; dx++)
+                result += (dx ? g[0] : 1 - g[0]) * (dy ? g[1] : 1 - g[1]) * (dz ? g[2] : 1 - g[2])
+                        * voxel(i[0] + dx, i[1] + dy, i[2] + dz);
+    return result;
+}
+
+template <typename Visitor>
+void SparseVolume::traverse(const Ray& r, double t0, double t1, Visitor visit) const {
+    if (blocks.empty()) return;
+
+    bool keepGoing = true;
+    gridDda(r, t0, t1, origin, blockExtent, blockRes, [&](const int blockCell[3], double blockEnter, double blockExit) {
+        int32_t block = blocks[((size_t)blockCell[2] * blockRes[1] + blockCell[1]) * blockRes[0] + blockCell[0]];
+        if (block < 0 || blockMajorants[block] <= 0) return true;
+
+        Point3 blockMin = origin + Vec3(blockCell[0] * blockExtent[0], blockCell[1] * blockExtent[1], blockCell[2] * blockExtent[2]);
+        const int bricksPerSide[3] = { blockSize, blockSize, blockSize };
+        gridDda(r, blockEnter, blockExit, blockMin, brickExtent, bricksPerSide,
+            [&](const int brickCell[3], double brickEnter, double brickExit) {
+            int32_t brick = brickIndices[(size_t)block * blockBricks + (brickCell[2] * blockSize + brickCell[1]) * blockSize + brickCell[0]];
+            if (brick < 0 || brickMajorants[brick] <= 0) return true;
+            keepGoing = visit(brickEnter, brickExit, (double)brickMajorants[brick]);
+            return keepGoing;
+        });
+        return keepGoing;
+    });
+}
+
+/**
+ * Keeps only the bricks of a dense grid that hold a density above `threshold`, for converting existing grids. The
+ * sparse volume starts at the grid's corner with the same voxel size.
+ */
+SparseVolume sparseFromDense(const DensityGrid& grid, float threshold = 0.0f) {
+    int bricks[3];
+    for (int a = 0; a < 3; a++) bricks[a] = (grid.res[a] + SparseVolume::brickSize - 1) / SparseVolume::brickSize;
+    SparseVolume volume(grid.bounds.min(), grid.voxelSize, bricks);
+
+    std::vector<float> values(SparseVolume::brickVoxels);
+    for (int z = 0; z < bricks[2]; z++) {
+        for (int y = 0; y < bricks[1]; y++) {
+            for (int x = 0; x < bricks[0]; x++) {
+                bool occupied = false;
+                for (int i = 0; i < SparseVolume::brickVoxels; i++) {
+                    int vx = x * 8 + i % 8, vy = y * 8 + (i / 8) % 8, vz = z * 8 + i / 64;
+                    bool inside = vx < grid.res[0] && vy < grid.res[1] && vz < grid.res[2];
+                    values[i] = inside ? grid.voxel(vx, vy, vz) : 0.0f;
+                    occupied = occupied || values[i] > threshold;
+                }
+                if (occupied) volume.addBrick(x, y, z, values.data());
+            }
+        }
+    }
+    volume.finalize();
+    return volume;
+}
+
+//// A simple binary file for sparse volumes: a header followed by one record per stored brick.
+
+const char sparseVolumeMagic[8] = { 'R', 'T', 'V', 'O', 'L', 0, 0, 0 };
+const uint32_t sparseVolumeVersion = 1;
+const uint32_t sparseVolumeEndianTag = 0x01020304;
+
+// Limits on what a file may ask for: bricks per axis, so voxel indices stay well inside int, and the size of the top
+//  level block table, which is dense and allocated up front.
+const int32_t sparseVolumeMaxBricks = 1 << 16;
+const uint64_t sparseVolumeMaxBlocks = 1 << 24;
+
+struct SparseVolumeHeader {
+    char magic[8];
+    uint32_t version;
+    uint32_t endianTag;
+    uint64_t brickCount;
+    double origin[3];
+    double voxelSize[3];
+};
+
+struct SparseVolumeBrick {
+    // In bricks from the origin, never negative.
+    int32_t coord[3];
+    float values[SparseVolume::brickVoxels];
+};
+
+// Writes every stored brick of `volume` to `filename`. Returns false if the file can't be written.
+bool writeSparseVolume(const char* filename, const SparseVolume& volume) {
+    std::ofstream out(filename, std::ios::binary | std::ios::trunc);
+    if (!out) {
+        std::cerr << "ERROR: Could not write volume '" << filename << "'.\n";
+        return false;
+    }
+
+    SparseVolumeHeader header;
+    memcpy(header.magic, sparseVolumeMagic, sizeof(header.magic));
+    header.version = sparseVolumeVersion;
+    header.endianTag = sparseVolumeEndianTag;
+    header.brickCount = volume.brickCount();
+    for (int a = 0; a < 3; a++) {
+        header.origin[a] = volume.origin[a];
+        header.voxelSize[a] = volume.voxelSize[a];
+    }
+    out.write(reinterpret_cast<const char*>(&header), sizeof(header));
+
+    SparseVolumeBrick record;
+    for (int bz = 0; bz < volume.blockRes[2]; bz++) {
+        for (int by = 0; by < volume.blockRes[1]; by++) {
+            for (int bx = 0; bx < volume.blockRes[0]; bx++) {
+                int32_t block = volume.blocks[((size_t)bz * volume.blockRes[1] + by) * volume.blockRes[0] + bx];
+                if (block < 0) continue;
+                for (int i = 0; i < SparseVolume::blockBricks; i++) {
+                    int32_t brick = volume.brickIndices[(size_t)block * SparseVolume::blockBricks + i];
+                    if (brick < 0) continue;
+                    record.coord[0] = bx * SparseVolume::blockSize + i % SparseVolume::blockSize;
+                    record.coord[1] = by * SparseVolume::blockSize + (i / SparseVolume::blockSize) % SparseVolume::blockSize;
+                    record.coord[2] = bz * SparseVolume::blockSize + i / (SparseVolume::blockSize * SparseVolume::blockSize);
+                    memcpy(record.values, &volume.brickValues[(size_t)brick * SparseVolume::brickVoxels], sizeof(record.values));
+                    out.write(reinterpret_cast<const char*>(&record), sizeof(record));
+                }
+            }
+        }
+    }
+
+    if (!out) {
+        std::cerr << "ERROR: Could not write volume '" << filename << "'.\n";
+        return false;
+    }
+    return true;
+}
+
+// Reads a volume written by writeSparseVolume. Returns false if the file is missing, from another version or damaged.
+bool loadSparseVolume(const char* filename, SparseVolume& volume) {
+    MappedFile file(filename);
+    if (!file.valid()) return false;
+
+    const SparseVolumeHeader* header = reinterpret_cast<const SparseVolumeHeader*>(file.data());
+    if (file.size() < sizeof(SparseVolumeHeader) || memcmp(header->magic, sparseVolumeMagic, sizeof(sparseVolumeMagic)) != 0
+        || header->version != sparseVolumeVersion || header->endianTag != sparseVolumeEndianTag
+        || header->brickCount != (file.size() - sizeof(SparseVolumeHeader)) / sizeof(SparseVolumeBrick)
+        || (file.size() - sizeof(SparseVolumeHeader)) % sizeof(SparseVolumeBrick) != 0) {
+        std::cerr << "ERROR: Volume '" << filename << "' is from another version or damaged.\n";
+        return false;
+    }
+    for (int a = 0; a < 3; a++) {
+        if (!std::isfinite(header->origin[a]) || !std::isfinite(header->voxelSize[a]) || !(header->voxelSize[a] > 0)) {
+            std::cerr << "ERROR: Volume '" << filename << "' is damaged.\n";
+            return false;
+        }
+    }
+
+    // The bricks may come in any order, find the extent of the volume first.
+    const SparseVolumeBrick* records = reinterpret_cast<const SparseVolumeBrick*>(file.data() + sizeof(SparseVolumeHeader));
+    int bricks[3] = { 0, 0, 0 };
+    for (uint64_t i = 0; i < header->brickCount; i++) {
+        for (int a = 0; a < 3; a++) {
+            if (records[i].coord[a] < 0 || records[i].coord[a] >= sparseVolumeMaxBricks) {
+                std::cerr << "ERROR: Volume '" << filename << "' is damaged or too large.\n";
+                return false;
+            }
+            bricks[a] = std::max(bricks[a], records[i].coord[a] + 1);
+        }
+    }
+    uint64_t blockCount = 1;
+    for (int a = 0; a < 3; a++) blockCount *= (uint64_t)(bricks[a] + SparseVolume::blockSize - 1) / SparseVolume::blockSize;
+    if (blockCount > sparseVolumeMaxBlocks) {
+        std::cerr << "ERROR: Volume '" << filename << "' is damaged or too large.\n";
+        return false;
+    }
+
+    volume = SparseVolume(Point3(header->origin[0], header->origin[1], header->origin[2]),
+                          Vec3(header->voxelSize[0], header->voxelSize[1], header->voxelSize[2]), bricks);
+    for (uint64_t i = 0; i < header->brickCount; i++) {
+        volume.addBrick(records[i].coord[0], records[i].coord[1], records[i].coord[2], records[i].values);
+    }
+    volume.finalize();
+    return true;
+}
+
+/**
+ * A SparseVolume as smoke. The volume's own bounds are the boundary, and collisions are found with delta tracking
+ * against the brick majorants of its two level walk.
+ */
+class SparseMedium : public Corporeal {
+    public:
+        // `densityScale` turns the values in the volume into extinction per unit of distance.
+        SparseMedium(shared_ptr<SparseVolume> volume, double densityScale, Color albedo)
+            : volume(volume), densityScale(densityScale), phaseFunction(make_shared<Isotropic>(albedo)) {}
+
+        virtual bool hit(const Ray& r, double tMin, double tMax, HitRecord& rec) const override {
+            double t1 = tMin, t2 = tMax;
+            if (!volume->bounds.clip(r, t1, t2)) return false;
+            if (!deltaTracking(r, t1, t2, densityScale, *volume, *volume, rec.t)) return false;
+            rec.object = this;
+            return true;
+        }
+
+        virtual void finishHit(const Ray& r, HitRecord& rec) const override {
+            rec.p = r.at(rec.t);
+            rec.normal = Vec3(1, 0, 0);
+            rec.frontFace = true;
+            rec.u = rec.v = 0;
+            rec.matPtr = phaseFunction;
+        }
+
+        virtual bool boundingBox(double time0, double time1, AABB& outputBox) const override {
+            outputBox = volume->bounds;
+            return true;
+        }
+
+    public:
+        shared_ptr<SparseVolume> volume;
+        double densityScale;
+        shared_ptr<Material> phaseFunction;
+};
+
+#endif
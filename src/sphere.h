@@ -4,6 +4,7 @@
 #include "corporeal.h"
 #include "vec3.h"
 #include "aabb.h"
+#include "fastMath.h"
 
 class Sphere : public Corporeal {
     public: 
@@ -13,20 +14,20 @@ class Sphere : public Corporeal {
 
         virtual bool hit(const Ray& r, double tMin, double tMax, HitRecord& rec) const override;
         virtual bool boundingBox(double time0, double time1, AABB& outputBox) const override;
+        virtual void finishHit(const Ray& r, HitRecord& rec) const override;
     public:
         Point3 center;
         double radius;
         shared_ptr<Material> matPtr;
 
-    private:
         /**
          * p: point on a unit sphere in the origin. 
          * u: returned value [0,1] of angle around Y axis from X=-1.
          * v: returned value [0,1] of angle from Y=-1 to Y=+1
          */
         static void getSphereUV(const Point3& p, double& u, double& v) {
-            auto theta = acos(-p.y());
-            auto phi = atan2(-p.z(), p.x()) + pi;
+            auto theta = acosApprox<shadingPrecision>(-p.y());
+            auto phi = atan2Approx<shadingPrecision>(-p.z(), p.x()) + pi;
             u = phi / (2*pi);
             v = theta / pi;
         }
@@ -60,16 +61,19 @@ bool Sphere::hit(const Ray& r, double tMin, double tMax, HitRecord& rec) const {
         if (solution < tMin || solution > tMax) return false;
     }
 
-    // That solution is the distance to the intersection. Add a record of it.
+    // That solution is the distance to the intersection. Add a record of it, the rest is only needed if it stays the closest.
     rec.t = solution;
+    rec.object = this;
+
+    return true;
+}
+
+void Sphere::finishHit(const Ray& r, HitRecord& rec) const {
     rec.p = r.at(rec.t);
-    rec.normal = (rec.p - center) / radius;
     Vec3 outwardNormal = (rec.p - center) / radius;
     rec.setFaceNormal(r, outwardNormal);
     getSphereUV(outwardNormal, rec.u, rec.v);
     rec.matPtr = matPtr;
-
-    return true;
 }
 
 #endif
\ No newline at end of file
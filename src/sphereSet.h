@@ -0,0 +1,270 @@
+#ifndef SPHERE_SET_H
+#define SPHERE_SET_H
+
+#include "tracer.h"
+#include "corporeal.h"
+#include "aabb.h"
+#include "flatBvh.h"
+#include "sphere.h"
+
+#include <cstdint>
+#include <vector>
+
+#ifdef __AVX2__
+#include <immintrin.h>
+#endif
+
+/**
+ * The sphere equation in double precision, the same math as Sphere::hit. Sets `t` to the nearest solution within
+ * [tMin, tMax].
+ */
+inline bool intersectSphere(const Point3& origin, const Vec3& direction, const Point3& center, double radius,
+    double tMin, double tMax, double& t) {
+    Vec3 originCenter = origin - center;
+    double a = direction.lengthSquared();
+    double halfB = dot(originCenter, direction);
+    double c = originCenter.lengthSquared() - radius*radius;
+
+    double discriminant = halfB*halfB - a*c;
+    if (discriminant < 0) return false;
+    double sqrtd = sqrt(discriminant);
+
+    t = (-halfB - sqrtd) / a;
+    if (t < tMin || t > tMax) {
+        t = (-halfB + sqrtd) / a;
+        if (t < tMin || t > tMax) return false;
+    }
+    return true;
+}
+
+/**
+ * Everything about a ray the sphere tests need, computed once per ray instead of once per leaf.
+ */
+struct SphereRay {
+    SphereRay(const Ray& r) : origin(r.origin()), direction(r.direction()) {
+        #ifdef __AVX2__
+        for (int a = 0; a < 3; a++) {
+            originLanes[a] = _mm256_set1_pd(origin[a]);
+            directionLanes[a] = _mm256_set1_ps((float)direction[a]);
+        }
+        negInvA = _mm256_set1_ps((float)(-1.0 / direction.lengthSquared()));
+        #endif
+    }
+
+    Point3 origin;
+    Vec3 direction;
+    #ifdef __AVX2__
+    // In double, the offsets to the centres are taken before anything is rounded to float.
+    __m256d originLanes[3];
+    __m256 directionLanes[3];
+    __m256 negInvA;
+    #endif
+};
+
+/**
+ * Tests up to eight spheres at once. `spheres` holds four float arrays (x, y and z of the centres, then the radii),
+ * each `stride` long, and the spheres are entries first..first+count-1 in them. Returns the lane of the closest hit
+ * within [tMin, tMax] or -1, and its distance.
+ *
+ * With AVX2 all eight are tested in float, which only serves as a filter: the few lanes that pass are solved again in
+ * double, so a secondary ray leaving a sphere doesn't hit it again through float rounding.
+ */
+inline int intersectSpheres8(const SphereRay& ray, const float* spheres, size_t stride, uint32_t first, uint32_t count,
+    double tMin, double tMax, double& t) {
+    const float* centerX = spheres + first;
+    const float* centerY = spheres + stride + first;
+    const float* centerZ = spheres + 2 * stride + first;
+    const float* radius = spheres + 3 * stride + first;
+
+    uint32_t candidates = (1u << count) - 1;
+    #ifdef __AVX2__
+    // The arrays are padded, so reading eight lanes past the last sphere is allowed, the extra lanes are masked out.
+    //  Origin minus centre is exact in double for float centres, so rounding it to float leaves a relative error of
+    //  one float epsilon however far both are from the world origin.
+    auto offset = [](__m256d origin, const float* center) {
+        __m256 c = _mm256_loadu_ps(center);
+        __m128 low = _mm256_cvtpd_ps(_mm256_sub_pd(origin, _mm256_cvtps_pd(_mm256_castps256_ps128(c))));
+        __m128 high = _mm256_cvtpd_ps(_mm256_sub_pd(origin, _mm256_cvtps_pd(_mm256_extractf128_ps(c, 1))));
+        return _mm256_insertf128_ps(_mm256_castps128_ps256(low), high, 1);
+    };
+    __m256 ocX = offset(ray.originLanes[0], centerX);
+    __m256 ocY = offset(ray.originLanes[1], centerY);
+    __m256 ocZ = offset(ray.originLanes[2], centerZ);
+    __m256 rad = _mm256_loadu_ps(radius);
+    const __m256* dir = ray.directionLanes;
+
+    // The discriminant as r^2 minus the squared distance of the centre to the ray line. The textbook b^2 - ac cancels
+    //  badly in float when the ray starts far from small spheres, this form doesn't.
+    __m256 centerT = _mm256_mul_ps(
+        _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(ocX, dir[0]), _mm256_mul_ps(ocY, dir[1])), _mm256_mul_ps(ocZ, dir[2])), ray.negInvA);
+    __m256 offX = _mm256_add_ps(ocX, _mm256_mul_ps(centerT, dir[0]));
+    __m256 offY = _mm256_add_ps(ocY, _mm256_mul_ps(centerT, dir[1]));
+    __m256 offZ = _mm256_add_ps(ocZ, _mm256_mul_ps(centerT, dir[2]));
+    __m256 radiusSquared = _mm256_mul_ps(rad, rad);
+    __m256 discriminant = _mm256_sub_ps(radiusSquared,
+        _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(offX, offX), _mm256_mul_ps(offY, offY)), _mm256_mul_ps(offZ, offZ)));
+    __m256 halfChord = _mm256_sqrt_ps(_mm256_mul_ps(_mm256_max_ps(discriminant, _mm256_setzero_ps()),
+                                                    _mm256_sub_ps(_mm256_setzero_ps(), ray.negInvA)));
+
+    // Loose on purpose, the double test decides: the ray has to pass within the radius (give or take some rounding),
+    //  and the sphere has to be in front of the origin and start before the closest hit so far. Rounding in the
+    //  offset from the ray grows with the distance to the centre, so the slack does too: 2^-20 |oc|^2 is well above
+    //  it once the centre is further than the radius, and r^2 / 1024 covers the rest.
+    __m256 ocLengthSquared = _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(ocX, ocX), _mm256_mul_ps(ocY, ocY)), _mm256_mul_ps(ocZ, ocZ));
+    __m256 slack = _mm256_add_ps(_mm256_mul_ps(radiusSquared, _mm256_set1_ps(1.0f / 1024)),
+                                 _mm256_mul_ps(ocLengthSquared, _mm256_set1_ps(1.0f / (1 << 20))));
+    __m256 hit = _mm256_cmp_ps(discriminant, _mm256_sub_ps(_mm256_setzero_ps(), slack), _CMP_GE_OQ);
+    hit = _mm256_and_ps(hit, _mm256_cmp_ps(_mm256_add_ps(centerT, halfChord), _mm256_setzero_ps(), _CMP_GE_OQ));
+    hit = _mm256_and_ps(hit, _mm256_cmp_ps(_mm256_sub_ps(centerT, halfChord), _mm256_set1_ps((float)tMax), _CMP_LE_OQ));
+    candidates &= (uint32_t)_mm256_movemask_ps(hit);
+    #endif
+
+    int closestLane = -1;
+    while (candidates) {
+        int i = __builtin_ctz(candidates);
+        candidates &= candidates - 1;
+        double laneT;
+        if (!intersectSphere(ray.origin, ray.direction, Point3(centerX[i], centerY[i], centerZ[i]), radius[i], tMin, tMax, laneT)) continue;
+        // Keep the closest lane, and only accept further ones that are even closer.
+        tMax = laneT;
+        t = laneT;
+        closestLane = i;
+    }
+    return closestLane;
+}
+
+/**
+ * A large number of spheres as a single object, for particle and molecule scenes. Centres and radii are stored as
+ * float arrays in the order of the leaves of a FlatBvh with up to eight spheres per leaf, so a leaf is intersected in
+ * one go. Traversal only tracks the closest sphere and its distance, the HitRecord is finished once for the winner.
+ */
+class SphereSet : public Corporeal {
+    public:
+        static const uint32_t leafSize = 8;
+
+        SphereSet() {}
+        /**
+         * centers, radii: one per sphere.
+         * materials:      the materials the spheres can have.
+         * materialIds:    index into `materials` per sphere. If empty every sphere gets the first material, and so do
+         *                 ids past the end of `materials`, which are reported.
+         */
+        SphereSet(const std::vector<Point3>& centers, const std::vector<double>& radii,
+            std::vector<shared_ptr<Material>> materials, const std::vector<uint16_t>& materialIds = std::vector<uint16_t>());
+        SphereSet(const std::vector<Point3>& centers, const std::vector<double>& radii, shared_ptr<Material> mat)
+            : SphereSet(centers, radii, std::vector<shared_ptr<Material>>{ mat }) {}
+
+        virtual bool hit(const Ray& r, double tMin, double tMax, HitRecord& rec) const override;
+        virtual bool boundingBox(double time0, double time1, AABB& outputBox) const override;
+        virtual void finishHit(const Ray& r, HitRecord& rec) const override;
+
+        size_t sphereCount() const { return materialIds.size(); }
+        Point3 center(uint32_t slot) const {
+            return Point3(packed[slot], packed[packedStride + slot], packed[2 * packedStride + slot]);
+        }
+        double radius(uint32_t slot) const { return packed[3 * packedStride + slot]; }
+
+        // Fills the record for a hit at distance `t` on the sphere in `slot` (its position in leaf order).
+        void fillHit(uint32_t slot, const Ray& r, double t, HitRecord& rec) const;
+
+        size_t memoryBytes() const {
+            return packed.size() * sizeof(float) + materialIds.size() * sizeof(uint16_t) + bvh.memoryBytes();
+        }
+
+    public:
+        FlatBvh bvh;
+        // x, y and z of the centres, then the radii, as four arrays of `packedStride` floats in BVH leaf order.
+        std::vector<float> packed;
+        size_t packedStride = 0;
+        // Material of every sphere, in leaf order as well.
+        std::vector<uint16_t> materialIds;
+        std::vector<shared_ptr<Material>> materials;
+};
+
+SphereSet::SphereSet(const std::vector<Point3>& centers, const std::vector<double>& radii,
+    std::vector<shared_ptr<Material>> materials, const std::vector<uint16_t>& materialIds)
+    : materials(std::move(materials)) {
+    // finishHit looks the material up by id, so every id has to name one.
+    if (this->materials.empty()) {
+        std::cerr << "ERROR: SphereSet without materials, using a grey one.\n";
+        this->materials.push_back(make_shared<Lambertian>(Color(0.7, 0.7, 0.7)));
+    }
+    bool useIds = !materialIds.empty();
+    if (useIds && materialIds.size() != centers.size()) {
+        std::cerr << "ERROR: SphereSet has " << materialIds.size() << " material ids for " << centers.size()
+                  << " spheres, using the first material for all.\n";
+        useIds = false;
+    }
+    size_t badIds = 0;
+    if (useIds) {
+        for (uint16_t id : materialIds) badIds += id >= this->materials.size();
+    }
+    if (badIds > 0) {
+        std::cerr << "ERROR: SphereSet has " << badIds << " material ids past its " << this->materials.size()
+                  << " materials, they get the first one.\n";
+    }
+
+    std::vector<AABB> bounds(centers.size());
+    for (size_t i = 0; i < centers.size(); i++) {
+        // A negative radius flips the normals (for hollow glass), the bounds are the same.
+        double r = fabs(radii[i]);
+        Vec3 extent(r, r, r);
+        bounds[i] = AABB(centers[i] - extent, centers[i] + extent);
+    }
+    bvh.build(bounds, leafSize);
+
+    // Padding lets the intersection load eight lanes starting at the last sphere.
+    packedStride = centers.size() + leafSize - 1;
+    packed.assign(4 * packedStride, 0.0f);
+    this->materialIds.resize(centers.size());
+    for (size_t slot = 0; slot < bvh.primIndices.size(); slot++) {
+        uint32_t sphere = bvh.primIndices[slot];
+        for (int a = 0; a < 3; a++) packed[a * packedStride + slot] = (float)centers[sphere][a];
+        packed[3 * packedStride + slot] = (float)radii[sphere];
+        uint16_t id = useIds ? materialIds[sphere] : 0;
+        this->materialIds[slot] = id < this->materials.size() ? id : 0;
+    }
+}
+
+bool SphereSet::boundingBox(double time0, double time1, AABB& outputBox) const {
+    if (bvh.empty()) return false;
+    outputBox = bvh.bounds();
+    return true;
+}
+
+bool SphereSet::hit(const Ray& r, double tMin, double tMax, HitRecord& rec) const {
+    uint32_t closestSlot = 0;
+    double closestT = tMax;
+    SphereRay ray(r);
+    bool hitAnything = bvh.hitLeaves(r, tMin, tMax,
+        [this, &ray, &closestSlot, &closestT](uint32_t first, uint32_t count, double tMin, double& closest) {
+        double t;
+        int lane = intersectSpheres8(ray, packed.data(), packedStride, first, count, tMin, closest, t);
+        if (lane < 0) return false;
+        closest = closestT = t;
+        closestSlot = first + lane;
+        return true;
+    });
+    if (!hitAnything) return false;
+
+    rec.t = closestT;
+    rec.primitive = closestSlot;
+    rec.object = this;
+    return true;
+}
+
+void SphereSet::finishHit(const Ray& r, HitRecord& rec) const {
+    fillHit(rec.primitive, r, rec.t, rec);
+}
+
+void SphereSet::fillHit(uint32_t slot, const Ray& r, double t, HitRecord& rec) const {
+    double sphereRadius = radius(slot);
+    rec.t = t;
+    rec.p = r.at(t);
+    Vec3 outwardNormal = (rec.p - center(slot)) / sphereRadius;
+    rec.setFaceNormal(r, outwardNormal);
+    Sphere::getSphereUV(outwardNormal, rec.u, rec.v);
+    rec.matPtr = materials[materialIds[slot]];
+}
+
+#endif
@@ -6,6 +6,7 @@
 
 #include "tracer.h"
 #include "perlin.h"
+#include "fastMath.h"
 
 class Texture {
     public:
@@ -33,7 +34,8 @@ class Checker : public Texture {
         Checker(Color c1, Color c2) : even(make_shared<SolidColor>(c1)), odd(make_shared<SolidColor>(c2)) {}
 
         virtual Color value(double u, double v, const Point3& p) const override {
-            auto sines = sin(10 * p.x()) * sin(10 * p.y()) * sin(10 * p.z());
+            auto sines = sinApprox<shadingPrecision>(10 * p.x()) * sinApprox<shadingPrecision>(10 * p.y())
+                       * sinApprox<shadingPrecision>(10 * p.z());
             if (sines < 0) return odd->value(u, v, p);
             else return even->value(u, v, p);
         }
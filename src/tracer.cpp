@@ -7,6 +7,21 @@
 #include "triangle.h"
 #include "aarect.h"
 #include "bvh.h"
+#include "motion.h"
+#include "triangleMesh.h"
+#include "objLoader.h"
+#include "sphereSet.h"
+#include "quad.h"
+#include "box.h"
+#include "instance.h"
+#include "medium.h"
+#include "perlin.h"
+#include "sparseVolume.h"
+#include "implicitSurface.h"
+#include "curveSet.h"
+#include "displacedSurface.h"
+#include "pagedMeshes.h"
+#include "wavefront.h"
 
 #include <iostream>
 #include <chrono>
@@ -20,15 +35,30 @@ void progressOut(int i, int imageHeight);
 void allocateThread(int pixelsToAllocate, int imageHeight, int imageWidth, int& i, int& j, CorporealList& world);
 void tracePixel(int iStart, int iEnd, int jStart, int jEnd, int imageHeight, int imageWidth, CorporealList world);
 Color rayColor(const Ray& r, const Color& background, const Corporeal& world, int depth);
+Color shadeHit(const Ray& r, HitRecord& rec, const Color& background, const Corporeal& world, int depth);
 double hitSphere(const Point3& center, double radius, const Ray& r);
 CorporealList randomScene();
 CorporealList devScene();
 CorporealList textureDemoScene();
 CorporealList lightTestScene();
+CorporealList motionBlurScene();
+CorporealList meshScene();
+CorporealList objScene();
+CorporealList particleScene();
+CorporealList cornellBoxScene();
+CorporealList instanceScene();
+CorporealList volumeScene();
+CorporealList sparseVolumeScene();
+CorporealList implicitScene();
+CorporealList furScene();
+CorporealList displacementScene();
+CorporealList pagedCityScene();
 
 int maxThreads = std::thread::hardware_concurrency();
 Color imageBuffer[imageHeight][imageWidth];
 std::vector<std::thread> threads;
+// Set by scenes with paged geometry, to report on paging after the render.
+shared_ptr<PagedMeshSet> pagedGeometry;
 
 
 int main() {
@@ -59,6 +89,74 @@ int main() {
             background = Color(0,0,0);
             break;
         }
+        case 4: {
+            world = motionBlurScene();
+            background = Color(0.70, 0.80, 1.00);
+            break;
+        }
+        case 5: {
+            world = meshScene();
+            background = Color(0.70, 0.80, 1.00);
+            break;
+        }
+        case 6: {
+            world = objScene();
+            background = Color(0.70, 0.80, 1.00);
+            break;
+        }
+        case 7: {
+            world = particleScene();
+            background = Color(0.70, 0.80, 1.00);
+            break;
+        }
+        case 8: {
+            world = cornellBoxScene();
+            background = Color(0,0,0);
+            // The box is 555 units wide, look into it through the open side.
+            cam = Camera(Point3(278, 278, -800), Point3(278, 278, 0), Vec3(0, 1, 0), 40.0, aspectRatio, 0.0, 10.0, shutterOpen, shutterClose);
+            break;
+        }
+        case 9: {
+            world = instanceScene();
+            background = Color(0.70, 0.80, 1.00);
+            break;
+        }
+        case 10: {
+            world = volumeScene();
+            background = Color(0,0,0);
+            cam = Camera(Point3(278, 278, -800), Point3(278, 278, 0), Vec3(0, 1, 0), 40.0, aspectRatio, 0.0, 10.0, shutterOpen, shutterClose);
+            break;
+        }
+        case 11: {
+            world = sparseVolumeScene();
+            background = Color(0,0,0);
+            cam = Camera(Point3(278, 278, -800), Point3(278, 278, 0), Vec3(0, 1, 0), 40.0, aspectRatio, 0.0, 10.0, shutterOpen, shutterClose);
+            break;
+        }
+        case 12: {
+            world = implicitScene();
+            background = Color(0.70, 0.80, 1.00);
+            cam = Camera(Point3(0, 3, 10), Point3(0, 1, 0), Vec3(0, 1, 0), 50.0, aspectRatio, 0.0, 10.0, shutterOpen, shutterClose);
+            break;
+        }
+        case 13: {
+            world = furScene();
+            background = Color(0.70, 0.80, 1.00);
+            cam = Camera(Point3(0, 2, 6), Point3(0, 0.9, 0), Vec3(0, 1, 0), 50.0, aspectRatio, 0.0, 10.0, shutterOpen, shutterClose);
+            break;
+        }
+        case 14: {
+            world = displacementScene();
+            background = Color(0.70, 0.80, 1.00);
+            cam = Camera(Point3(0, 6, 14), Point3(0, 0, 0), Vec3(0, 1, 0), 50.0, aspectRatio, 0.0, 10.0, shutterOpen, shutterClose);
+            break;
+        }
+        case 15: {
+            world = pagedCityScene();
+            background = Color(0.70, 0.80, 1.00);
+            cam = Camera(Point3(-30, 25, -30), Point3(40, 0, 40), Vec3(0, 1, 0), 60.0, aspectRatio, 0.0, 10.0, shutterOpen, shutterClose);
+            break;
+        }
     }
 
     // Define output
@@ -99,6 +197,10 @@ int main() {
     std::chrono::steady_clock::time_point end = std::chrono::steady_clock::now();
 
     std::cerr << "\nRender complete.\n";
+    if (pagedGeometry) pagedGeometry->report(std::cerr);
+    #ifdef WAVEFRONT
+    WavefrontIntegrator::report(std::cerr);
+    #endif
     std::cerr << "Elapsed time = " << std::chrono::duration_cast<std::chrono::milliseconds>(end - begin).count() << " [ms]" << std::endl;
     return 0;
 }
@@ -135,11 +237,48 @@ void allocateThread(int pixelsToAllocate, int imageHeight, int imageWidth, int&
 void tracePixel(int iStart, int iEnd, int jStart, int jEnd, int imageHeight, int imageWidth, CorporealList world) {
     int i = iStart;
     int j = jStart;
+
+    #ifdef WAVEFRONT
+    // The same pixels as below, but all handed to the integrator in one go.
+    std::vector<Pixel> pixels;
+    while (i > iEnd || (i == iEnd && j < jEnd)) {
+        for (; j < imageWidth || (i == iEnd && j < jEnd); j++) pixels.push_back(Pixel{ i, j });
+        i--;
+        j = 0;
+    }
+    std::vector<Color> colors(pixels.size());
+    WavefrontIntegrator(world, background, maxBounceDepth).render(pixels, samplesPerPixel, colors);
+    for (size_t k = 0; k < pixels.size(); k++) imageBuffer[pixels[k].i][pixels[k].j] = colors[k];
+    return;
+    #endif
     
     // While we still have rows to render, or we are on the last row but not the last pixel to render
     while (i > iEnd || (i == iEnd && j < jEnd)) {
         // Trace pixels until the end of the row or if we are on the last row until the designated stop spot.
         while (j < imageWidth || (i == iEnd && j < jEnd)) {
+            #ifdef RAY_PACKETS
+            // The next few pixels of the row at once, a packet holds the same sample of each.
+            int run = std::min(packetSize, imageWidth - j);
+            Color pixelColors[packetSize];
+            for (int sample = 0; sample < samplesPerPixel; sample++) {
+                RayPacket packet;
+                for (int k = 0; k < run; k++) {
+                    auto u = (j + k + randomDouble()) / (imageWidth - 1);
+                    auto v = (i + randomDouble()) / (imageHeight - 1);
+                    packet.add(cam.getRay(u, v));
+                }
+                PacketHits hits;
+                for (int k = 0; k < run; k++) hits.tMax[k] = infinity;
+                world.hitPacket(packet, packet.allRays(), 0.001, hits);
+                // From the first hit on, every ray goes its own way.
+                for (int k = 0; k < run; k++) {
+                    pixelColors[k] += (hits.hitMask & (1u << k))
+                        ? shadeHit(packet.rays[k], hits.rec[k], background, world, maxBounceDepth) : background;
+                }
+            }
+            for (int k = 0; k < run; k++) imageBuffer[i][j + k] = pixelColors[k];
+            j += run;
+            #else
             // Render a pixel
             Color pixelColor(0,0,0);
             for (int sample = 0; sample < samplesPerPixel; sample++) {
@@ -153,6 +292,7 @@ void tracePixel(int iStart, int iEnd, int jStart, int jEnd, int imageHeight, int
             // Write the Color to `cout`
             imageBuffer[i][j] = pixelColor;
             j++;
+            #endif
         }
         // Decrement the row and reset the j pointer
         i--;
@@ -171,21 +311,28 @@ Color rayColor(const Ray& r, const Color& background, const Corporeal& world, in
     
     // If the ray hits a physical ("Corporeal") object, diffuse. tMin is 0.001 to solve floating point bugs around 0.
     if (world.hit(r, 0.001, infinity, rec)) {
-        Ray scattered;
-        Color attenuation;
-        Color emitted = rec.matPtr->emitted(rec.u, rec.v, rec.p);
-        
-        // Scatter the ray in accordance with the Corporeal's Material.
-        if (rec.matPtr->scatter(r, rec, attenuation, scattered)) {
-            return emitted + attenuation * rayColor(scattered, background, world, depth - 1);
-        }
-        // If the material doesn't scatter we return the emitted color.
-        return emitted;
+        return shadeHit(r, rec, background, world, depth);
     }
     // If we don't hit anything in the first place we return the BG color.
     return background;
 }
 
+// The color `r` brings back from its closest hit `rec`, with `depth` bounces left including this one.
+Color shadeHit(const Ray& r, HitRecord& rec, const Color& background, const Corporeal& world, int depth) {
+    // Only now that we know it's the closest, work out the rest of the hit.
+    rec.finish(r);
+    Ray scattered;
+    Color attenuation;
+    Color emitted = rec.matPtr->emitted(rec.u, rec.v, rec.p);
+    
+    // Scatter the ray in accordance with the Corporeal's Material.
+    if (rec.matPtr->scatter(r, rec, attenuation, scattered)) {
+        return emitted + attenuation * rayColor(scattered, background, world, depth - 1);
+    }
+    // If the material doesn't scatter we return the emitted color.
+    return emitted;
+}
+
 
 double hitSphere(const Point3& center, double radius, const Ray& r) {
     //Vector from origin of the Ray to the center of the sphere
@@ -252,6 +399,393 @@ CorporealList lightTestScene() {
     return objects;
 }
 
+CorporealList motionBlurScene() {
+    CorporealList objects;
+
+    auto groundMat = make_shared<Lambertian>(make_shared<Checker>(Color(0.2, 0.3, 0.1), Color(0.9, 0.9, 0.9)));
+    objects.add(make_shared<Sphere>(Point3(0, -1000, 0), 1000, groundMat));
+
+    // A field of small spheres where every other one bounces up during the shutter interval.
+    for (int a = -6; a < 6; a++) {
+        for (int b = -6; b < 6; b++) {
+            Point3 center(a + 0.9 * randomDouble(), 0.2, b + 0.9 * randomDouble());
+            auto sphere = make_shared<Sphere>(center, 0.2, make_shared<Lambertian>(Color::random() * Color::random()));
+
+            if ((a + b) % 2 == 0) {
+                objects.add(make_shared<LinearMotion>(sphere, Vec3(0, randomDouble(0, 0.5), 0), shutterOpen, shutterClose));
+            } else {
+                objects.add(sphere);
+            }
+        }
+    }
+
+    return CorporealList(make_shared<BvhNode>(objects, shutterOpen, shutterClose));
+}
+
+CorporealList meshScene() {
+    CorporealList objects;
+
+    // A rolling landscape as one indexed mesh: every vertex is shared by up to six triangles.
+    const int gridSize = 200;
+    const double extent = 30.0;
+    std::vector<float> positions;
+    std::vector<float> uvs;
+    std::vector<uint32_t> indices;
+
+    for (int i = 0; i <= gridSize; i++) {
+        for (int j = 0; j <= gridSize; j++) {
+            double x = extent * (double(j) / gridSize - 0.5);
+            double z = extent * (double(i) / gridSize - 0.5);
+            positions.push_back((float)x);
+            positions.push_back((float)(0.6 * sin(0.7 * x) * cos(0.5 * z)));
+            positions.push_back((float)z);
+            uvs.push_back((float)(double(j) / gridSize));
+            uvs.push_back((float)(double(i) / gridSize));
+        }
+    }
+    for (int i = 0; i < gridSize; i++) {
+        for (int j = 0; j < gridSize; j++) {
+            uint32_t a = i * (gridSize + 1) + j;
+            uint32_t b = a + 1;
+            uint32_t c = a + (gridSize + 1);
+            uint32_t d = c + 1;
+            // Counter clockwise seen from above, so the front faces up.
+            indices.insert(indices.end(), { a, c, b, b, c, d });
+        }
+    }
+
+    auto groundMat = make_shared<Lambertian>(make_shared<Checker>(Color(0.2, 0.3, 0.1), Color(0.9, 0.9, 0.9)));
+    objects.add(make_shared<TriangleMesh>(std::move(positions), std::move(indices), groundMat, std::vector<float>(), std::move(uvs)));
+    objects.add(make_shared<Sphere>(Point3(0, 2, 0), 1.5, make_shared<Metal>(Color(0.7, 0.6, 0.5), 0.0)));
+
+    return CorporealList(make_shared<BvhNode>(objects, shutterOpen, shutterClose));
+}
+
+CorporealList objScene() {
+    CorporealList objects;
+
+    auto groundMat = make_shared<Lambertian>(make_shared<Checker>(Color(0.2, 0.3, 0.1), Color(0.9, 0.9, 0.9)));
+    objects.add(make_shared<Sphere>(Point3(0, -1000, 0), 1000, groundMat));
+
+    // Half copper, half clay according to its MTL file.
+    loadObj("src/obj/icosphere.obj", objects);
+
+    return CorporealList(make_shared<BvhNode>(objects, shutterOpen, shutterClose));
+}
+
+CorporealList particleScene() {
+    CorporealList objects;
+
+    auto groundMat = make_shared<Lambertian>(make_shared<Checker>(Color(0.2, 0.3, 0.1), Color(0.9, 0.9, 0.9)));
+    objects.add(make_shared<Sphere>(Point3(0, -1000, 0), 1000, groundMat));
+
+    // A swirl of half a million particles in a few materials, all in one SphereSet.
+    const int particleCount = 500000;
+    std::vector<Point3> centers;
+    std::vector<double> radii;
+    std::vector<uint16_t> materialIds;
+    std::vector<shared_ptr<Material>> materials = {
+        make_shared<Lambertian>(Color(0.8, 0.3, 0.1)),
+        make_shared<Lambertian>(Color(0.9, 0.8, 0.2)),
+        make_shared<Metal>(Color(0.7, 0.7, 0.8), 0.1)
+    };
+    for (int i = 0; i < particleCount; i++) {
+        double along = randomDouble();
+        double angle = 6 * pi * along + randomDouble(0, 0.6);
+        double distance = 1.0 + 3.0 * along + randomDouble(-0.4, 0.4);
+        centers.push_back(Point3(distance * cos(angle), 0.3 + 4.0 * along + randomDouble(-0.2, 0.2), distance * sin(angle)));
+        radii.push_back(randomDouble(0.01, 0.03));
+        materialIds.push_back((uint16_t)randomInt(0, 2));
+    }
+    objects.add(make_shared<SphereSet>(centers, radii, materials, materialIds));
+
+    return CorporealList(make_shared<BvhNode>(objects, shutterOpen, shutterClose));
+}
+
+CorporealList cornellBoxScene() {
+    CorporealList objects;
+
+    auto red   = make_shared<Lambertian>(Color(.65, .05, .05));
+    auto white = make_shared<Lambertian>(Color(.73, .73, .73));
+    auto green = make_shared<Lambertian>(Color(.12, .45, .15));
+    auto light = make_shared<DiffuseLight>(Color(15, 15, 15));
+
+    objects.add(make_shared<YZ_Rectangle>(0, 555, 0, 555, 555, green));
+    objects.add(make_shared<YZ_Rectangle>(0, 555, 0, 555, 0, red));
+    objects.add(make_shared<XZ_Rectangle>(213, 343, 227, 332, 554, light));
+    objects.add(make_shared<XZ_Rectangle>(0, 555, 0, 555, 0, white));
+    objects.add(make_shared<XZ_Rectangle>(0, 555, 0, 555, 555, white));
+    objects.add(make_shared<XY_Rectangle>(0, 555, 0, 555, 555, white));
+
+    // Each box is one object with a single slab test, not six rectangles. They are built at the origin and turned into place.
+    auto box1 = make_shared<Box>(Point3(0, 0, 0), Point3(165, 330, 165), white);
+    objects.add(make_shared<Instance>(box1, Transform::translate(Vec3(265, 0, 295)) * Transform::rotate(Vec3(0, 1, 0), 15)));
+    auto box2 = make_shared<Box>(Point3(0, 0, 0), Point3(165, 165, 165), white);
+    objects.add(make_shared<Instance>(box2, Transform::translate(Vec3(130, 0, 65)) * Transform::rotate(Vec3(0, 1, 0), -18)));
+    // A tilted mirror leaning against the back wall.
+    objects.add(make_shared<Quad>(Point3(40, 0, 420), Vec3(80, 0, 0), Vec3(0, 300, 120), make_shared<Metal>(Color(0.8, 0.85, 0.88), 0.0)));
+
+    return CorporealList(make_shared<BvhNode>(objects, shutterOpen, shutterClose));
+}
+
+CorporealList instanceScene() {
+    CorporealList objects;
+
+    auto groundMat = make_shared<Lambertian>(make_shared<Checker>(Color(0.2, 0.3, 0.1), Color(0.9, 0.9, 0.9)));
+    objects.add(make_shared<Sphere>(Point3(0, -1000, 0), 1000, groundMat));
+
+    // The mesh is loaded once, every copy is just a transform pointing at it.
+    CorporealList parts;
+    loadObj("src/obj/icosphere.obj", parts);
+    shared_ptr<Corporeal> mesh = make_shared<BvhNode>(parts, shutterOpen, shutterClose);
+
+    CorporealList copies;
+    for (int a = -20; a < 20; a++) {
+        for (int b = -20; b < 20; b++) {
+            double size = randomDouble(0.08, 0.15);
+            Point3 position(a * 0.5 + randomDouble(0, 0.2), 0, b * 0.5 + randomDouble(0, 0.2));
+            // Every other copy is only moved, which takes the fast path.
+            if ((a + b) % 2 == 0) {
+                copies.add(make_shared<Instance>(mesh, Transform::translate(position) * Transform::scale(size)));
+            } else {
+                Transform place = Transform::translate(position)
+                                * Transform::rotate(Vec3(randomDouble(-1, 1), 1, randomDouble(-1, 1)), randomDouble(0, 360))
+                                * Transform::scale(Vec3(size, size * randomDouble(0.5, 1.5), size));
+                copies.add(make_shared<Instance>(mesh, place));
+            }
+        }
+    }
+    objects.add(make_shared<BvhNode>(copies, shutterOpen, shutterClose));
+
+    return CorporealList(make_shared<BvhNode>(objects, shutterOpen, shutterClose));
+}
+
+CorporealList volumeScene() {
+    CorporealList objects;
+
+    auto red   = make_shared<Lambertian>(Color(.65, .05, .05));
+    auto white = make_shared<Lambertian>(Color(.73, .73, .73));
+    auto green = make_shared<Lambertian>(Color(.12, .45, .15));
+    auto light = make_shared<DiffuseLight>(Color(7, 7, 7));
+
+    objects.add(make_shared<YZ_Rectangle>(0, 555, 0, 555, 555, green));
+    objects.add(make_shared<YZ_Rectangle>(0, 555, 0, 555, 0, red));
+    objects.add(make_shared<XZ_Rectangle>(113, 443, 127, 432, 554, light));
+    objects.add(make_shared<XZ_Rectangle>(0, 555, 0, 555, 0, white));
+    objects.add(make_shared<XZ_Rectangle>(0, 555, 0, 555, 555, white));
+    objects.add(make_shared<XY_Rectangle>(0, 555, 0, 555, 555, white));
+
+    // A block of dark smoke of constant density.
+    auto block = make_shared<Box>(Point3(0, 0, 0), Point3(165, 330, 165), white);
+    auto placed = make_shared<Instance>(block, Transform::translate(Vec3(265, 0, 295)) * Transform::rotate(Vec3(0, 1, 0), 15));
+    objects.add(make_shared<ConstantMedium>(placed, 0.01, Color(0, 0, 0)));
+
+    // A cloud of turbulence inside a sphere, mostly empty space around it.
+    const int n = 64;
+    Perlin noise;
+    std::vector<float> values((size_t)n * n * n);
+    for (int z = 0; z < n; z++) {
+        for (int y = 0; y < n; y++) {
+            for (int x = 0; x < n; x++) {
+                Point3 p((x + 0.5) / n, (y + 0.5) / n, (z + 0.5) / n);
+                double falloff = fmax(0.0, 1.0 - 2.2 * (p - Point3(0.5, 0.5, 0.5)).length());
+                values[((size_t)z * n + y) * n + x] = (float)(falloff * noise.turbulence(4 * p));
+            }
+        }
+    }
+    AABB cloudBounds(Point3(80, 120, 40), Point3(300, 340, 260));
+    auto grid = make_shared<DensityGrid>(n, n, n, cloudBounds, std::move(values));
+    auto cloudBoundary = make_shared<Box>(cloudBounds.min(), cloudBounds.max(), white);
+    objects.add(make_shared<GridMedium>(cloudBoundary, grid, 0.1, Color(1, 1, 1)));
+
+    return CorporealList(make_shared<BvhNode>(objects, shutterOpen, shutterClose));
+}
+
+CorporealList sparseVolumeScene() {
+    CorporealList objects;
+
+    auto red   = make_shared<Lambertian>(Color(.65, .05, .05));
+    auto white = make_shared<Lambertian>(Color(.73, .73, .73));
+    auto green = make_shared<Lambertian>(Color(.12, .45, .15));
+    auto light = make_shared<DiffuseLight>(Color(7, 7, 7));
+
+    objects.add(make_shared<YZ_Rectangle>(0, 555, 0, 555, 555, green));
+    objects.add(make_shared<YZ_Rectangle>(0, 555, 0, 555, 0, red));
+    objects.add(make_shared<XZ_Rectangle>(113, 443, 127, 432, 554, light));
+    objects.add(make_shared<XZ_Rectangle>(0, 555, 0, 555, 0, white));
+    objects.add(make_shared<XZ_Rectangle>(0, 555, 0, 555, 555, white));
+    objects.add(make_shared<XY_Rectangle>(0, 555, 0, 555, 555, white));
+
+    // A plume of smoke winding up through the whole box. Generating it takes a while, so it's kept in a file.
+    const char* filename = "plume.rtvol";
+    auto volume = make_shared<SparseVolume>();
+    if (access(filename, R_OK) != 0 || !loadSparseVolume(filename, *volume)) {
+        // 256^3 voxels over the box, but only the bricks near a helix get stored.
+        const int bricks[3] = { 32, 32, 32 };
+        const double voxel = 555.0 / 256;
+        *volume = SparseVolume(Point3(0, 0, 0), Vec3(voxel, voxel, voxel), bricks);
+
+        Perlin noise;
+        auto helixDistance = [](const Point3& p) {
+            double angle = p.y() / 555 * 2 * 2 * pi;
+            Point3 centre(278 + 110 * cos(angle), p.y(), 278 + 110 * sin(angle));
+            return (p - centre).length();
+        };
+        const double radius = 40;
+        std::vector<float> values(SparseVolume::brickVoxels);
+        for (int z = 0; z < bricks[2]; z++) {
+            for (int y = 0; y < bricks[1]; y++) {
+                for (int x = 0; x < bricks[0]; x++) {
+                    // The distance changes at most ~3 times as fast as the point moves (moving up turns the helix),
+                    // so nothing in a brick is within the radius if its centre is this far out.
+                    Point3 centre = Point3(x + 0.5, y + 0.5, z + 0.5) * (voxel * SparseVolume::brickSize);
+                    if (helixDistance(centre) > radius + 3 * voxel * SparseVolume::brickSize) continue;
+                    for (int i = 0; i < SparseVolume::brickVoxels; i++) {
+                        Point3 p = Point3(x * 8 + i % 8 + 0.5, y * 8 + (i / 8) % 8 + 0.5, z * 8 + i / 64 + 0.5) * voxel;
+                        double falloff = fmax(0.0, 1.0 - helixDistance(p) / radius);
+                        values[i] = (float)(falloff * noise.turbulence(p / 40));
+                    }
+                    volume->addBrick(x, y, z, values.data());
+                }
+            }
+        }
+        volume->finalize();
+        writeSparseVolume(filename, *volume);
+    }
+    std::cerr << "Plume: " << volume->brickCount() << " bricks, " << volume->memoryBytes() / (1024 * 1024) << " MiB (dense: "
+              << (size_t)256 * 256 * 256 * sizeof(float) / (1024 * 1024) << " MiB)\n";
+    objects.add(make_shared<SparseMedium>(volume, 1.0, Color(1, 1, 1)));
+
+    return CorporealList(make_shared<BvhNode>(objects, shutterOpen, shutterClose));
+}
+
+CorporealList implicitScene() {
+    CorporealList objects;
+
+    auto groundMat = make_shared<Lambertian>(make_shared<Checker>(Color(0.2, 0.3, 0.1), Color(0.9, 0.9, 0.9)));
+    objects.add(make_shared<Sphere>(Point3(0, -1000, 0), 1000, groundMat));
+
+    // A fractal that would take millions of triangles, marched directly.
+    auto bulb = make_shared<SdfMandelbulb>(Point3(0, 1, 0), 1.0);
+    objects.add(make_shared<ImplicitSurface>(bulb, make_shared<Lambertian>(Color(0.8, 0.5, 0.3))));
+
+    // A torus melted into a rounded box, in glass.
+    auto ring = make_shared<SdfTorus>(Point3(2.8, 0.9, 0), 0.6, 0.2);
+    auto block = make_shared<SdfRoundBox>(Point3(2.8, 0.5, 0), Vec3(0.5, 0.5, 0.5), 0.1);
+    objects.add(make_shared<ImplicitSurface>(make_shared<SdfSmoothUnion>(ring, block, 0.3), make_shared<Dielectric>(1.5)));
+
+    // Two spheres flowing into each other, in metal.
+    auto left = make_shared<SdfSphere>(Point3(-2.8, 0.7, -0.4), 0.7);
+    auto right = make_shared<SdfSphere>(Point3(-2.8, 0.6, 0.6), 0.6);
+    objects.add(make_shared<ImplicitSurface>(make_shared<SdfSmoothUnion>(left, right, 0.5), make_shared<Metal>(Color(0.7, 0.6, 0.5), 0.0)));
+
+    return CorporealList(make_shared<BvhNode>(objects, shutterOpen, shutterClose));
+}
+
+CorporealList furScene() {
+    CorporealList objects;
+
+    auto groundMat = make_shared<Lambertian>(Color(0.35, 0.25, 0.15));
+    objects.add(make_shared<Sphere>(Point3(0, -1000, 0), 1000, groundMat));
+
+    // A ball of fur, every hair bending down a little under its own weight.
+    std::vector<Point3> controlPoints;
+    std::vector<double> widths;
+    const Point3 ballCenter(0, 1, 0);
+    for (int i = 0; i < 60000; i++) {
+        Vec3 root = randomUnitVector();
+        double length = randomDouble(0.25, 0.35);
+        for (int k = 0; k < 4; k++) {
+            double along = k / 3.0;
+            controlPoints.push_back(ballCenter + (0.8 + length * along) * root - Vec3(0, 0.15 * along * along, 0));
+        }
+        widths.push_back(0.006);
+        widths.push_back(0.001);
+    }
+    objects.add(make_shared<Sphere>(ballCenter, 0.8, make_shared<Lambertian>(Color(0.3, 0.2, 0.1))));
+    objects.add(make_shared<CurveSet>(controlPoints, widths, make_shared<Lambertian>(Color(0.8, 0.6, 0.3))));
+
+    // Grass around it, leaning in random directions.
+    controlPoints.clear();
+    widths.clear();
+    for (int i = 0; i < 100000; i++) {
+        Point3 root(randomDouble(-4, 4), 0, randomDouble(-4, 2));
+        Vec3 lean(randomDouble(-0.15, 0.15), 0, randomDouble(-0.15, 0.15));
+        double height = randomDouble(0.15, 0.3);
+        for (int k = 0; k < 4; k++) {
+            double along = k / 3.0;
+            controlPoints.push_back(root + Vec3(0, height * along, 0) + along * along * lean);
+        }
+        widths.push_back(0.01);
+        widths.push_back(0.002);
+    }
+    objects.add(make_shared<CurveSet>(controlPoints, widths, make_shared<Lambertian>(Color(0.2, 0.5, 0.1))));
+
+    return CorporealList(make_shared<BvhNode>(objects, shutterOpen, shutterClose));
+}
+
+CorporealList displacementScene() {
+    CorporealList objects;
+
+    // Rolling hills from a coarse control grid, with fine noise displaced on top.
+    const int n = 48;
+    std::vector<Point3> controlPoints;
+    for (int j = 0; j < n; j++) {
+        for (int i = 0; i < n; i++) {
+            double x = -24 + 48.0 * i / (n - 1), z = 24 - 48.0 * j / (n - 1);
+            controlPoints.push_back(Point3(x, 1.5 * sin(0.5 * x) * cos(0.4 * z) + randomDouble(-0.3, 0.3), z));
+        }
+    }
+    // Fully tessellated this is 4 million triangles taking about 380 MB, the cache keeps what's in use.
+    auto cache = make_shared<GeometryCache>(256 * 1024 * 1024);
+    auto hills = make_shared<DisplacedSurface>(controlPoints, n, n, make_shared<NoiseTexture>(3), 0.4, 32, cache,
+                                               make_shared<Lambertian>(Color(0.4, 0.5, 0.3)));
+    objects.add(hills);
+    objects.add(make_shared<Sphere>(Point3(0, 3, 0), 1.5, make_shared<Metal>(Color(0.8, 0.8, 0.8), 0.0)));
+
+    return CorporealList(make_shared<BvhNode>(objects, shutterOpen, shutterClose));
+}
+
+CorporealList pagedCityScene() {
+    CorporealList objects;
+
+    auto groundMat = make_shared<Lambertian>(Color(0.3, 0.3, 0.3));
+    objects.add(make_shared<Sphere>(Point3(0, -10000, 0), 10000, groundMat));
+
+    // A city of a quarter million buildings, written once as clusters and from then on paged in from the file.
+    const char* filename = "city.rtmesh";
+    if (access(filename, R_OK) != 0) {
+        const int blocks = 500;
+        std::vector<float> positions;
+        std::vector<uint32_t> indices;
+        // The sides and roof of a box, counter clockwise seen from outside.
+        const uint32_t faces[30] = { 0, 3, 2, 0, 1, 3,  4, 7, 5, 4, 6, 7,  0, 5, 1, 0, 4, 5,  2, 7, 6, 2, 3, 7,  1, 7, 3, 1, 5, 7 };
+        for (int z = 0; z < blocks; z++) {
+            for (int x = 0; x < blocks; x++) {
+                double width = randomDouble(0.4, 0.8), depth = randomDouble(0.4, 0.8);
+                double height = randomDouble(0.3, 1.0) * randomDouble(0.3, 1.0) * 6;
+                Point3 low(x - width / 2, 0, z - depth / 2);
+                uint32_t base = (uint32_t)(positions.size() / 3);
+                for (int corner = 0; corner < 8; corner++) {
+                    positions.push_back((float)(low.x() + (corner & 4 ? width : 0)));
+                    positions.push_back((float)(corner & 2 ? height : 0));
+                    positions.push_back((float)(low.z() + (corner & 1 ? depth : 0)));
+                }
+                for (uint32_t k : faces) indices.push_back(base + k);
+            }
+        }
+        CorporealList city;
+        city.add(make_shared<TriangleMesh>(std::move(positions), std::move(indices), groundMat));
+        writeMeshClusters(filename, city);
+    }
+
+    // A budget well below the size of the file, most of the city is never resident at the same time.
+    pagedGeometry = openPagedMeshes(filename, 16 * 1024 * 1024, make_shared<Lambertian>(Color(0.75, 0.7, 0.65)));
+    if (pagedGeometry) objects.add(pagedGeometry);
+
+    return CorporealList(make_shared<BvhNode>(objects, shutterOpen, shutterClose));
+}
+
 CorporealList randomScene() {
     CorporealList objects;
 
@@ -4,12 +4,25 @@
 // #define WIREFRAME_MODE          // Bounding box rendering
 #define FRAME_THICKNESS 0.05 
 #define CULLING                 // Triangles are planes - transparent on the backside
+// #define BVH_REPORT              // Report the quality of every BVH after it is built
+#define BVH_REPORT_FILE "bvhReport.json"
+#define RAY_PACKETS             // Trace camera rays of neighbouring pixels together
+// #define WAVEFRONT               // Render with the stage by stage integrator instead of rayColor
+// #define FAST_SHADING_MATH       // Polynomial approximations for the trig in shading and texturing, see fastMath.h
+// #define SINGLE_PRECISION        // Vectors, points and colours in float instead of double
 
 #include <cmath>
 #include <limits>
 #include <memory>
 #include <cstdlib>
 
+// The scalar type of Vec3, and with it everything stored as points, directions and colours.
+#ifdef SINGLE_PRECISION
+typedef float Real;
+#else
+typedef double Real;
+#endif
+
 // Utility constants
 const double infinity = std::numeric_limits<double>::infinity();
 const double pi = 3.1415926535897932385;
@@ -72,9 +85,12 @@ Vec3 cameraUp = Vec3(0, 1, 0);
 auto hFOV = 50.0;
 auto distToFocus = 10.0;
 auto aperture = 0.1;
+// Shutter interval, rays are sent out at random times within it. Moving objects and BVHs should be built on the same interval.
+auto shutterOpen = 0.0;
+auto shutterClose = 1.0;
 Color background(0,0,0);
 
-Camera cam(cameraOrigin, cameraLookAt, cameraUp, hFOV, aspectRatio, aperture, distToFocus);
+Camera cam(cameraOrigin, cameraLookAt, cameraUp, hFOV, aspectRatio, aperture, distToFocus, shutterOpen, shutterClose);
 
 
 #endif
\ No newline at end of file
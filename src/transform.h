@@ -0,0 +1,118 @@
+#ifndef TRANSFORM_H
+#define TRANSFORM_H
+
+#include "tracer.h"
+
+/**
+ * An affine transform as a 3x4 matrix: a linear part in the first three columns and a translation in the last. The
+ * bottom row of a full 4x4 matrix is always 0 0 0 1, so it isn't stored.
+ */
+class Transform {
+    public:
+        Transform() {
+            for (int i = 0; i < 3; i++)
+                for (int j = 0; j < 4; j++) m[i][j] = i == j ? 1.0 : 0.0;
+        }
+
+        static Transform translate(const Vec3& offset) {
+            Transform t;
+            for (int i = 0; i < 3; i++) t.m[i][3] = offset[i];
+            return t;
+        }
+
+        static Transform scale(const Vec3& factors) {
+            Transform t;
+            for (int i = 0; i < 3; i++) t.m[i][i] = factors[i];
+            return t;
+        }
+        static Transform scale(double factor) { return scale(Vec3(factor, factor, factor)); }
+
+        // Rotation around `axis` by `degrees`, counter clockwise looking down the axis (Rodrigues' formula).
+        static Transform rotate(const Vec3& axis, double degrees) {
+            Vec3 a = unitVector(axis);
+            double s = sin(degreesToRadians(degrees));
+            double c = cos(degreesToRadians(degrees));
+            Transform t;
+            for (int i = 0; i < 3; i++) {
+                for (int j = 0; j < 3; j++) t.m[i][j] = a[i] * a[j] * (1 - c) + (i == j ? c : 0.0);
+            }
+            t.m[0][1] -= a.z() * s; t.m[1][0] += a.z() * s;
+            t.m[0][2] += a.y() * s; t.m[2][0] -= a.y() * s;
+            t.m[1][2] -= a.x() * s; t.m[2][1] += a.x() * s;
+            return t;
+        }
+
+        // `a * b` applies b first, then a.
+        friend Transform operator*(const Transform& a, const Transform& b) {
+            Transform t;
+            for (int i = 0; i < 3; i++) {
+                for (int j = 0; j < 4; j++) {
+                    t.m[i][j] = a.m[i][0] * b.m[0][j] + a.m[i][1] * b.m[1][j] + a.m[i][2] * b.m[2][j];
+                }
+                t.m[i][3] += a.m[i][3];
+            }
+            return t;
+        }
+
+        Point3 applyPoint(const Point3& p) const {
+            return Point3(
+                m[0][0] * p.x() + m[0][1] * p.y() + m[0][2] * p.z() + m[0][3],
+                m[1][0] * p.x() + m[1][1] * p.y() + m[1][2] * p.z() + m[1][3],
+                m[2][0] * p.x() + m[2][1] * p.y() + m[2][2] * p.z() + m[2][3]);
+        }
+
+        // Directions ignore the translation.
+        Vec3 applyVector(const Vec3& v) const {
+            return Vec3(
+                m[0][0] * v.x() + m[0][1] * v.y() + m[0][2] * v.z(),
+                m[1][0] * v.x() + m[1][1] * v.y() + m[1][2] * v.z(),
+                m[2][0] * v.x() + m[2][1] * v.y() + m[2][2] * v.z());
+        }
+
+        // Normals are transformed by the transposed linear part. Call this on the inverse to transform them forward.
+        Vec3 applyTransposed(const Vec3& n) const {
+            return Vec3(
+                m[0][0] * n.x() + m[1][0] * n.y() + m[2][0] * n.z(),
+                m[0][1] * n.x() + m[1][1] * n.y() + m[2][1] * n.z(),
+                m[0][2] * n.x() + m[1][2] * n.y() + m[2][2] * n.z());
+        }
+
+        double determinant() const {
+            return m[0][0] * (m[1][1] * m[2][2] - m[1][2] * m[2][1])
+                 - m[0][1] * (m[1][0] * m[2][2] - m[1][2] * m[2][0])
+                 + m[0][2] * (m[1][0] * m[2][1] - m[1][1] * m[2][0]);
+        }
+
+        // Inverse through the adjugate of the linear part. The transform must not be singular (like a scale by 0).
+        Transform inverse() const {
+            double invDet = 1.0 / determinant();
+            Transform t;
+            t.m[0][0] =  (m[1][1] * m[2][2] - m[1][2] * m[2][1]) * invDet;
+            t.m[0][1] = -(m[0][1] * m[2][2] - m[0][2] * m[2][1]) * invDet;
+            t.m[0][2] =  (m[0][1] * m[1][2] - m[0][2] * m[1][1]) * invDet;
+            t.m[1][0] = -(m[1][0] * m[2][2] - m[1][2] * m[2][0]) * invDet;
+            t.m[1][1] =  (m[0][0] * m[2][2] - m[0][2] * m[2][0]) * invDet;
+            t.m[1][2] = -(m[0][0] * m[1][2] - m[0][2] * m[1][0]) * invDet;
+            t.m[2][0] =  (m[1][0] * m[2][1] - m[1][1] * m[2][0]) * invDet;
+            t.m[2][1] = -(m[0][0] * m[2][1] - m[0][1] * m[2][0]) * invDet;
+            t.m[2][2] =  (m[0][0] * m[1][1] - m[0][1] * m[1][0]) * invDet;
+            // The inverse translation is the inverse linear part applied to the negated translation.
+            Vec3 translation = t.applyVector(-Vec3(m[0][3], m[1][3], m[2][3]));
+            for (int i = 0; i < 3; i++) t.m[i][3] = translation[i];
+            return t;
+        }
+
+        // Whether the linear part is the identity, so the transform only moves things.
+        bool isTranslation() const {
+            for (int i = 0; i < 3; i++)
+                for (int j = 0; j < 3; j++)
+                    if (m[i][j] != (i == j ? 1.0 : 0.0)) return false;
+            return true;
+        }
+        Vec3 translation() const { return Vec3(m[0][3], m[1][3], m[2][3]); }
+
+    public:
+        double m[3][4];
+};
+
+#endif
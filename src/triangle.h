@@ -10,43 +10,56 @@ class Triangle : public Corporeal {
     public: 
         Triangle () {}
         Triangle (Point3 v0, Point3 v1, Point3 v2, shared_ptr<Material> mat) 
-            : v0(v0), v1(v1), v2(v2), matPtr(mat) {};
+            : v0(v0), v1(v1), v2(v2), matPtr(mat) {
+            // These only depend on the vertices, no need to recompute them for every ray.
+            edge1 = v1 - v0;
+            edge2 = v2 - v0;
+            normal = unitVector(cross(edge1, edge2));
+        };
 
         virtual bool hit(const Ray& r, double tMin, double tMax, HitRecord& rec) const override;
         virtual bool boundingBox(double time0, double time1, AABB& outputBox) const override;
-        bool mollerTrumboreIntersection(const Ray& r, Vec3& hitLocation, float& t) const;
+        virtual void finishHit(const Ray& r, HitRecord& rec) const override;
+        bool mollerTrumboreIntersection(const Ray& r, double tMin, double tMax, Vec3& hitLocation, double& t) const;
     public:
         Point3 v0;
         Point3 v1;
         Point3 v2;
+        Vec3 edge1;
+        Vec3 edge2;
+        Vec3 normal;
         shared_ptr<Material> matPtr;
 };
 
 bool Triangle::hit(const Ray& r, double tMin, double tMax, HitRecord& rec) const {
     // Calculate whether the ray hits the triangle
     Vec3 hitLocation;
-    float distance;
-    bool hit = mollerTrumboreIntersection(r, hitLocation, distance);
+    double distance;
+    bool hit = mollerTrumboreIntersection(r, tMin, tMax, hitLocation, distance);
     if (!hit) return false;
     
-    // We hit. Add a record of it.
+    // We hit. Add a record of it, the barycentrics are kept for the UVs.
     rec.t = distance;
-    rec.p = r.at(rec.t);
-    rec.normal = cross((v1 - v0), (v2 - v0));
-    Vec3 outwardNormal = cross((v1 - v0), (v2 - v0));
-    rec.setFaceNormal(r, outwardNormal);
-    rec.matPtr = matPtr;
+    rec.b1 = hitLocation[0];
+    rec.b2 = hitLocation[1];
+    rec.object = this;
 
     return true;
 }
 
-bool Triangle::mollerTrumboreIntersection(const Ray& r, Vec3& hitLocation, float& t) const {
-    float baryU, baryV;
-    Vec3 edge1 = v1 - v0;
-    Vec3 edge2 = v2 - v0;
+void Triangle::finishHit(const Ray& r, HitRecord& rec) const {
+    rec.p = r.at(rec.t);
+    rec.setFaceNormal(r, normal);
+    rec.u = rec.b1;
+    rec.v = rec.b2;
+    rec.matPtr = matPtr;
+}
+
+bool Triangle::mollerTrumboreIntersection(const Ray& r, double tMin, double tMax, Vec3& hitLocation, double& t) const {
+    double baryU, baryV;
 
     Vec3 crossRayDirEdge2 = cross(r.direction(), edge2);
-    float determinant = dot(edge1, crossRayDirEdge2);
+    double determinant = dot(edge1, crossRayDirEdge2);
 
     #ifdef CULLING
     // If the determinant is less than 0 the ray does not hit. 
@@ -55,22 +68,24 @@ bool Triangle::mollerTrumboreIntersection(const Ray& r, Vec3& hitLocation, float
     // If the determinant is close to 0 the ray and triangle are parallel.
     if (fabs(determinant) < EPSILON) return false;
     #endif
+    double invDet = 1/determinant;
     // Calculate distance from v0 to ray origin
     Vec3 tvec = r.origin() - v0;
-    // Calculate barycentric u coordinate
-    baryU = dot(tvec, crossRayDirEdge2);
-    // If the barycentric u coordinate is less than 0 or greater than the determinant we know we did not hit the triangle, quick exit.
-    if (baryU < 0.0 || baryU > determinant) return false;
+    // Calculate barycentric u coordinate. Scaling by invDet right away keeps the tests below valid for back faces,
+    // where the determinant is negative.
+    baryU = dot(tvec, crossRayDirEdge2) * invDet;
+    // If the barycentric u coordinate is outside [0, 1] we know we did not hit the triangle, quick exit.
+    if (baryU < 0.0 || baryU > 1.0) return false;
 
     Vec3 qvec = cross(tvec, edge1);
-    baryV = dot(r.direction(), qvec);
-    if (baryV < 0.0 || baryU + baryV > determinant) return 0;
+    baryV = dot(r.direction(), qvec) * invDet;
+    if (baryV < 0.0 || baryU + baryV > 1.0) return false;
 
-    // We know we've hit:  finish up Cramer's rule operations. Divide by determinant.
-    float invDet = 1/determinant;
+    // We know we've hit the plane inside the triangle:  finish up Cramer's rule operations.
     t = dot(edge2, qvec) * invDet;
-    hitLocation[0] = baryU * invDet;
-    hitLocation[1] = baryV * invDet;
+    if (t < tMin || t > tMax) return false;
+    hitLocation[0] = baryU;
+    hitLocation[1] = baryV;
     hitLocation[2] = 1 - baryU - baryV;
 
     return true;
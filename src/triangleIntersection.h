@@ -0,0 +1,196 @@
+#ifndef TRIANGLE_INTERSECTION_H
+#define TRIANGLE_INTERSECTION_H
+
+#include "tracer.h"
+
+#include <cstdint>
+#include <cstring>
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+/**
+ * Watertight ray/triangle intersection (Woop, Benthin & Wald 2013). The ray is turned into a shear transform that
+ * maps it onto the +z axis, which is computed once per ray. Every triangle is then tested in that 2D space with edge
+ * functions evaluated on its vertices, so two triangles sharing an edge evaluate it identically and no ray can slip
+ * through the gap between them. Edge values of exactly 0 are recomputed in double precision.
+ */
+struct WatertightRay {
+    WatertightRay(const Ray& r) {
+        const Vec3& dir = r.direction();
+        // kz is the dimension the direction is largest in, kx and ky the other two in winding order.
+        kz = 0;
+        if (fabs(dir.y()) > fabs(dir[kz])) kz = 1;
+        if (fabs(dir.z()) > fabs(dir[kz])) kz = 2;
+        kx = (kz + 1) % 3;
+        ky = (kx + 1) % 3;
+        // Swapping keeps the winding of the triangles the same after the transform.
+        if (dir[kz] < 0) std::swap(kx, ky);
+
+        sz = r.invDir[kz];
+        sx = dir[kx] * sz;
+        sy = dir[ky] * sz;
+        origin = r.origin();
+        for (int a = 0; a < 3; a++) originFloat[a] = (float)origin[a];
+    }
+
+    int kx, ky, kz;
+    double sx, sy, sz;
+    Point3 origin;
+    float originFloat[3];
+};
+
+/**
+ * Scalar watertight test in double precision. On a hit fills `t` and the barycentric weights of v0, v1 and v2.
+ * With CULLING the back side of a triangle (clockwise as seen from the ray) is not hit.
+ */
+inline bool intersectTriangleWatertight(const WatertightRay& ray, const Point3& v0, const Point3& v1, const Point3& v2,
+    double tMin, double tMax, double& t, double& b0, double& b1, double& b2) {
+    // Vertices relative to the ray origin, sheared so the ray runs along +z.
+    Vec3 a = v0 - ray.origin;
+    Vec3 b = v1 - ray.origin;
+    Vec3 c = v2 - ray.origin;
+    double ax = a[ray.kx] - ray.sx * a[ray.kz], ay = a[ray.ky] - ray.sy * a[ray.kz];
+    double bx = b[ray.kx] - ray.sx * b[ray.kz], by = b[ray.ky] - ray.sy * b[ray.kz];
+    double cx = c[ray.kx] - ray.sx * c[ray.kz], cy = c[ray.ky] - ray.sy * c[ray.kz];
+
+    // Scaled barycentric coordinates: twice the signed area of the triangle the ray forms with each edge.
+    double u = cx * by - cy * bx;
+    double v = ax * cy - ay * cx;
+    double w = bx * ay - by * ax;
+
+    #ifdef CULLING
+    if (u < 0 || v < 0 || w < 0) return false;
+    #else
+    if ((u < 0 || v < 0 || w < 0) && (u > 0 || v > 0 || w > 0)) return false;
+    #endif
+
+    double det = u + v + w;
+    if (det == 0) return false;
+
+    // Distance along the ray, still scaled by det.
+    double scaledT = u * ray.sz * a[ray.kz] + v * ray.sz * b[ray.kz] + w * ray.sz * c[ray.kz];
+    if (det < 0 ? (scaledT > tMin * det || scaledT < tMax * det) : (scaledT < tMin * det || scaledT > tMax * det)) return false;
+
+    double invDet = 1.0 / det;
+    t = scaledT * invDet;
+    b0 = u * invDet;
+    b1 = v * invDet;
+    b2 = w * invDet;
+    return true;
+}
+
+/**
+ * Tests up to four triangles at once. `vertices` holds nine float arrays (x, y and z of v0, then of v1, then of v2),
+ * each `stride` long, and the triangles are entries first..first+count-1 in them. Returns the lane of the closest hit
+ * within [tMin, tMax] or -1, and its distance and barycentric weights.
+ */
+inline int intersectTriangles4(const WatertightRay& ray, const float* vertices, size_t stride, uint32_t first, uint32_t count,
+    double tMin, double tMax, double& t, double& b0, double& b1, double& b2) {
+    // Start of the component arrays this ray needs, in its sheared axis order.
+    const float* v[3][3];
+    for (int corner = 0; corner < 3; corner++) {
+        v[corner][0] = vertices + (3 * corner + ray.kx) * stride + first;
+        v[corner][1] = vertices + (3 * corner + ray.ky) * stride + first;
+        v[corner][2] = vertices + (3 * corner + ray.kz) * stride + first;
+    }
+    float ox = ray.originFloat[ray.kx], oy = ray.originFloat[ray.ky], oz = ray.originFloat[ray.kz];
+    float sx = (float)ray.sx, sy = (float)ray.sy, sz = (float)ray.sz;
+
+    float u[4], w[4], vv[4], scaledT[4];
+    #ifdef __SSE2__
+    // The arrays are padded, so reading four lanes past the last triangle is allowed, the extra lanes are masked out.
+    __m128 ax = _mm_sub_ps(_mm_loadu_ps(v[0][0]), _mm_set1_ps(ox));
+    __m128 ay = _mm_sub_ps(_mm_loadu_ps(v[0][1]), _mm_set1_ps(oy));
+    __m128 az = _mm_sub_ps(_mm_loadu_ps(v[0][2]), _mm_set1_ps(oz));
+    __m128 bx = _mm_sub_ps(_mm_loadu_ps(v[1][0]), _mm_set1_ps(ox));
+    __m128 by = _mm_sub_ps(_mm_loadu_ps(v[1][1]), _mm_set1_ps(oy));
+    __m128 bz = _mm_sub_ps(_mm_loadu_ps(v[1][2]), _mm_set1_ps(oz));
+    __m128 cx = _mm_sub_ps(_mm_loadu_ps(v[2][0]), _mm_set1_ps(ox));
+    __m128 cy = _mm_sub_ps(_mm_loadu_ps(v[2][1]), _mm_set1_ps(oy));
+    __m128 cz = _mm_sub_ps(_mm_loadu_ps(v[2][2]), _mm_set1_ps(oz));
+
+    __m128 shearX = _mm_set1_ps(sx), shearY = _mm_set1_ps(sy);
+    __m128 axs = _mm_sub_ps(ax, _mm_mul_ps(shearX, az)), ays = _mm_sub_ps(ay, _mm_mul_ps(shearY, az));
+    __m128 bxs = _mm_sub_ps(bx, _mm_mul_ps(shearX, bz)), bys = _mm_sub_ps(by, _mm_mul_ps(shearY, bz));
+    __m128 cxs = _mm_sub_ps(cx, _mm_mul_ps(shearX, cz)), cys = _mm_sub_ps(cy, _mm_mul_ps(shearY, cz));
+
+    __m128 uLane = _mm_sub_ps(_mm_mul_ps(cxs, bys), _mm_mul_ps(cys, bxs));
+    __m128 vLane = _mm_sub_ps(_mm_mul_ps(axs, cys), _mm_mul_ps(ays, cxs));
+    __m128 wLane = _mm_sub_ps(_mm_mul_ps(bxs, ays), _mm_mul_ps(bys, axs));
+    __m128 scale = _mm_set1_ps(sz);
+    __m128 tLane = _mm_add_ps(_mm_add_ps(_mm_mul_ps(uLane, _mm_mul_ps(scale, az)), _mm_mul_ps(vLane, _mm_mul_ps(scale, bz))),
+                              _mm_mul_ps(wLane, _mm_mul_ps(scale, cz)));
+
+    // Cheap rejection of all four lanes before looking at them one by one.
+    __m128 zero = _mm_setzero_ps();
+    #ifdef CULLING
+    __m128 outside = _mm_or_ps(_mm_or_ps(_mm_cmplt_ps(uLane, zero), _mm_cmplt_ps(vLane, zero)), _mm_cmplt_ps(wLane, zero));
+    #else
+    __m128 anyNegative = _mm_or_ps(_mm_or_ps(_mm_cmplt_ps(uLane, zero), _mm_cmplt_ps(vLane, zero)), _mm_cmplt_ps(wLane, zero));
+    __m128 anyPositive = _mm_or_ps(_mm_or_ps(_mm_cmpgt_ps(uLane, zero), _mm_cmpgt_ps(vLane, zero)), _mm_cmpgt_ps(wLane, zero));
+    __m128 outside = _mm_and_ps(anyNegative, anyPositive);
+    #endif
+    int laneMask = (1 << count) - 1;
+    if ((~_mm_movemask_ps(outside) & laneMask) == 0) return -1;
+
+    _mm_storeu_ps(u, uLane);
+    _mm_storeu_ps(vv, vLane);
+    _mm_storeu_ps(w, wLane);
+    _mm_storeu_ps(scaledT, tLane);
+    #else
+    for (uint32_t i = 0; i < count; i++) {
+        float ax = v[0][0][i] - ox, ay = v[0][1][i] - oy, az = v[0][2][i] - oz;
+        float bx = v[1][0][i] - ox, by = v[1][1][i] - oy, bz = v[1][2][i] - oz;
+        float cx = v[2][0][i] - ox, cy = v[2][1][i] - oy, cz = v[2][2][i] - oz;
+        float axs = ax - sx * az, ays = ay - sy * az;
+        float bxs = bx - sx * bz, bys = by - sy * bz;
+        float cxs = cx - sx * cz, cys = cy - sy * cz;
+        u[i] = cxs * bys - cys * bxs;
+        vv[i] = axs * cys - ays * cxs;
+        w[i] = bxs * ays - bys * axs;
+        scaledT[i] = u[i] * sz * az + vv[i] * sz * bz + w[i] * sz * cz;
+    }
+    #endif
+
+    int closestLane = -1;
+    for (uint32_t i = 0; i < count; i++) {
+        double laneT, l0, l1, l2;
+        if (u[i] == 0 || vv[i] == 0 || w[i] == 0) {
+            // On an edge in float precision: only double precision can say which of the neighbours is hit.
+            Point3 p0(v[0][0][i], v[0][1][i], v[0][2][i]), p1(v[1][0][i], v[1][1][i], v[1][2][i]), p2(v[2][0][i], v[2][1][i], v[2][2][i]);
+            // The component arrays were picked in sheared order, put them back in xyz order.
+            Point3 q0, q1, q2;
+            q0[ray.kx] = p0.x(); q0[ray.ky] = p0.y(); q0[ray.kz] = p0.z();
+            q1[ray.kx] = p1.x(); q1[ray.ky] = p1.y(); q1[ray.kz] = p1.z();
+            q2[ray.kx] = p2.x(); q2[ray.ky] = p2.y(); q2[ray.kz] = p2.z();
+            if (!intersectTriangleWatertight(ray, q0, q1, q2, tMin, tMax, laneT, l0, l1, l2)) continue;
+        } else {
+            #ifdef CULLING
+            if (u[i] < 0 || vv[i] < 0 || w[i] < 0) continue;
+            #else
+            if ((u[i] < 0 || vv[i] < 0 || w[i] < 0) && (u[i] > 0 || vv[i] > 0 || w[i] > 0)) continue;
+            #endif
+            double det = (double)u[i] + vv[i] + w[i];
+            if (det == 0) continue;
+            double invDet = 1.0 / det;
+            laneT = scaledT[i] * invDet;
+            if (laneT < tMin || laneT > tMax) continue;
+            l0 = u[i] * invDet;
+            l1 = vv[i] * invDet;
+            l2 = w[i] * invDet;
+        }
+
+        // Keep the closest lane, and only accept further ones that are even closer.
+        tMax = laneT;
+        t = laneT;
+        b0 = l0;
+        b1 = l1;
+        b2 = l2;
+        closestLane = (int)i;
+    }
+    return closestLane;
+}
+
+#endif
@@ -0,0 +1,185 @@
+#ifndef TRIANGLE_MESH_H
+#define TRIANGLE_MESH_H
+
+#include "tracer.h"
+#include "corporeal.h"
+#include "aabb.h"
+#include "flatBvh.h"
+#include "meshBuffer.h"
+#include "triangleIntersection.h"
+
+#include <cstdint>
+#include <vector>
+
+/**
+ * A mesh of triangles that share their vertices and one material. Instead of every triangle being its own object
+ * with three Point3s and a material pointer, the vertex data lives in flat float arrays and a triangle is just three
+ * indices into them. The triangles are handed to a FlatBvh by index, so the whole mesh is a single Corporeal.
+ */
+class TriangleMesh : public Corporeal {
+    public:
+        TriangleMesh() {}
+        /**
+         * positions: xyz per vertex.
+         * indices:   three vertex indices per triangle, counter clockwise seen from the front.
+         * normals:   optional xyz per vertex, interpolated for smooth shading.
+         * uvs:       optional uv per vertex, interpolated for texturing.
+         * bvh:       optional tree built over these triangles before, like one loaded from a cache. Built if empty.
+         * packed:    optional packedVertices made for that tree, see below. Packed here if empty.
+         */
+        TriangleMesh(
+            MeshBuffer<float> positions, MeshBuffer<uint32_t> indices, shared_ptr<Material> mat,
+            MeshBuffer<float> normals = MeshBuffer<float>(), MeshBuffer<float> uvs = MeshBuffer<float>(),
+            FlatBvh bvh = FlatBvh(), MeshBuffer<float> packed = MeshBuffer<float>())
+            : positions(std::move(positions)), normals(std::move(normals)), uvs(std::move(uvs)),
+              indices(std::move(indices)), matPtr(mat), bvh(std::move(bvh)), packedVertices(std::move(packed)) {
+            // Packed vertices are in leaf order, they only fit the tree they were made for.
+            if (this->bvh.empty()) {
+                buildBvh();
+                packedVertices = MeshBuffer<float>();
+            }
+            packedStride = packedVertexStride(triangleCount());
+            if (packedVertices.size() != 9 * packedStride) packTriangles();
+        }
+
+        virtual bool hit(const Ray& r, double tMin, double tMax, HitRecord& rec) const override;
+        virtual bool boundingBox(double time0, double time1, AABB& outputBox) const override;
+        virtual void finishHit(const Ray& r, HitRecord& rec) const override;
+
+        size_t vertexCount() const { return positions.size() / 3; }
+        size_t triangleCount() const { return indices.size() / 3; }
+        Point3 vertex(uint32_t i) const { return Point3(positions[3*i], positions[3*i + 1], positions[3*i + 2]); }
+
+        AABB triangleBounds(uint32_t triangle) const;
+        bool hitTriangle(uint32_t triangle, const Ray& r, double tMin, double tMax, HitRecord& rec) const;
+        // Fills the record for a hit found on `triangle` with these barycentric weights of its vertices.
+        void fillHit(uint32_t triangle, const Ray& r, double t, double b0, double b1, double b2, HitRecord& rec) const;
+
+        // (Re)builds the BVH over the triangles, needed after changing the buffers.
+        void buildBvh();
+        // Copies the vertices into `packedVertices` in BVH leaf order, needed after (re)building the BVH.
+        void packTriangles();
+
+        // Bytes used by the vertex data, indices and BVH together.
+        size_t memoryBytes() const {
+            return positions.ownedBytes() + normals.ownedBytes() + uvs.ownedBytes() + indices.ownedBytes() 
+                 + packedVertices.ownedBytes() + bvh.memoryBytes();
+        }
+
+    public:
+        MeshBuffer<float> positions;
+        MeshBuffer<float> normals;
+        MeshBuffer<float> uvs;
+        MeshBuffer<uint32_t> indices;
+        shared_ptr<Material> matPtr;
+        FlatBvh bvh;
+
+        /**
+         * The corners of every triangle once more, in the order the BVH leaves reference them, as nine arrays of
+         * `packedStride` floats: x, y and z of v0, then of v1 and v2. A leaf's triangles sit next to each other in
+         * every array, so they are loaded four at a time without following the indices.
+         */
+        MeshBuffer<float> packedVertices;
+        size_t packedStride = 0;
+
+        // Padding lets the intersection load four lanes starting at the last triangle.
+        static size_t packedVertexStride(size_t triangleCount) { return triangleCount + 3; }
+};
+
+void TriangleMesh::packTriangles() {
+    packedStride = packedVertexStride(triangleCount());
+    std::vector<float> packed(9 * packedStride, 0.0f);
+    for (size_t slot = 0; slot < bvh.primIndices.size(); slot++) {
+        uint32_t triangle = bvh.primIndices[slot];
+        for (int corner = 0; corner < 3; corner++) {
+            uint32_t v = indices[3*triangle + corner];
+            for (int a = 0; a < 3; a++) packed[(3 * corner + a) * packedStride + slot] = positions[3*v + a];
+        }
+    }
+    packedVertices = std::move(packed);
+}
+
+void TriangleMesh::buildBvh() {
+    std::vector<AABB> bounds(triangleCount());
+    for (uint32_t i = 0; i < bounds.size(); i++) bounds[i] = triangleBounds(i);
+    bvh.build(bounds);
+}
+
+AABB TriangleMesh::triangleBounds(uint32_t triangle) const {
+    Point3 v0 = vertex(indices[3*triangle]);
+    Point3 v1 = vertex(indices[3*triangle + 1]);
+    Point3 v2 = vertex(indices[3*triangle + 2]);
+
+    // Same as Triangle::boundingBox, a triangle lying in an axis plane gets a flat box which the slab test handles.
+    return AABB(
+        Point3(fmin(fmin(v0.x(), v1.x()), v2.x()), fmin(fmin(v0.y(), v1.y()), v2.y()), fmin(fmin(v0.z(), v1.z()), v2.z())),
+        Point3(fmax(fmax(v0.x(), v1.x()), v2.x()), fmax(fmax(v0.y(), v1.y()), v2.y()), fmax(fmax(v0.z(), v1.z()), v2.z()))
+    );
+}
+
+bool TriangleMesh::boundingBox(double time0, double time1, AABB& outputBox) const {
+    if (bvh.empty()) return false;
+    outputBox = bvh.bounds();
+    return true;
+}
+
+bool TriangleMesh::hit(const Ray& r, double tMin, double tMax, HitRecord& rec) const {
+    WatertightRay ray(r);
+    return bvh.hitLeaves(r, tMin, tMax, [this, &ray, &rec](uint32_t first, uint32_t count, double tMin, double& closest) {
+        double t, b0, b1, b2;
+        int lane = intersectTriangles4(ray, packedVertices.data(), packedStride, first, count, tMin, closest, t, b0, b1, b2);
+        if (lane < 0) return false;
+        rec.t = closest = t;
+        rec.primitive = bvh.primIndices[first + lane];
+        rec.b1 = b1;
+        rec.b2 = b2;
+        rec.object = this;
+        return true;
+    });
+}
+
+void TriangleMesh::finishHit(const Ray& r, HitRecord& rec) const {
+    fillHit(rec.primitive, r, rec.t, 1.0 - rec.b1 - rec.b2, rec.b1, rec.b2, rec);
+}
+
+bool TriangleMesh::hitTriangle(uint32_t triangle, const Ray& r, double tMin, double tMax, HitRecord& rec) const {
+    double t, b0, b1, b2;
+    WatertightRay ray(r);
+    if (!intersectTriangleWatertight(ray, vertex(indices[3*triangle]), vertex(indices[3*triangle + 1]),
+        vertex(indices[3*triangle + 2]), tMin, tMax, t, b0, b1, b2)) return false;
+    // A single triangle is filled in right away, there is nothing to defer it for.
+    fillHit(triangle, r, t, b0, b1, b2, rec);
+    rec.object = nullptr;
+    return true;
+}
+
+void TriangleMesh::fillHit(uint32_t triangle, const Ray& r, double t, double b0, double b1, double b2, HitRecord& rec) const {
+    uint32_t i0 = indices[3*triangle];
+    uint32_t i1 = indices[3*triangle + 1];
+    uint32_t i2 = indices[3*triangle + 2];
+    Point3 v0 = vertex(i0);
+
+    rec.t = t;
+    rec.p = r.at(t);
+
+    Vec3 outwardNormal = unitVector(cross(vertex(i1) - v0, vertex(i2) - v0));
+    rec.setFaceNormal(r, outwardNormal);
+    if (!normals.empty()) {
+        // Smooth shading: interpolate the vertex normals, but keep the side of the face the geometric normal chose.
+        Vec3 shading = b0 * Vec3(normals[3*i0], normals[3*i0 + 1], normals[3*i0 + 2])
+                     + b1 * Vec3(normals[3*i1], normals[3*i1 + 1], normals[3*i1 + 2])
+                     + b2 * Vec3(normals[3*i2], normals[3*i2 + 1], normals[3*i2 + 2]);
+        rec.normal = unitVector(rec.frontFace ? shading : -shading);
+    }
+
+    if (!uvs.empty()) {
+        rec.u = b0 * uvs[2*i0]     + b1 * uvs[2*i1]     + b2 * uvs[2*i2];
+        rec.v = b0 * uvs[2*i0 + 1] + b1 * uvs[2*i1 + 1] + b2 * uvs[2*i2 + 1];
+    } else {
+        rec.u = b1;
+        rec.v = b2;
+    }
+    rec.matPtr = matPtr;
+}
+
+#endif
@@ -3,33 +3,48 @@
 
 #include <cmath>
 #include <iostream>
+#include <type_traits>
 
 using std::sqrt;
 
-class Vec3 {
+/**
+ * Three components of scalar type T, used for points, directions and colours alike. The renderer uses one precision
+ * throughout, `Vec3` is Vec3T<Real> (see SINGLE_PRECISION in tracer.h). Scalars mixed in (like `0.5 * v`) are
+ * converted to T, so the same code builds in either precision.
+ *
+ * The storage is three packed Ts on purpose: padding to four lanes for SSE would give back most of what floats save
+ * in memory, and the hot bulk data (packed triangles, sphere sets, BVH nodes) is kept in separate float arrays anyway.
+ */
+template <typename T>
+class Vec3T {
     public:
-        Vec3() : e{0,0,0} {};
-        Vec3(double e0, double e1, double e2) : e{e0, e1, e2} {};
+        typedef T Scalar;
+
+        Vec3T() : e{0,0,0} {};
+        Vec3T(T e0, T e1, T e2) : e{e0, e1, e2} {};
+        // Converting between precisions has to be asked for.
+        template <typename U>
+        explicit Vec3T(const Vec3T<U>& v) : e{(T)v.e[0], (T)v.e[1], (T)v.e[2]} {};
         
         // Getters for XYZ or their alias RGB
-        double x() const { return e[0];}
-        double y() const { return e[1];}
-        double z() const { return e[2];}
-        double r() const { return e[0];}
-        double g() const { return e[1];}
-        double b() const { return e[2];}
+        T x() const { return e[0];}
+        T y() const { return e[1];}
+        T z() const { return e[2];}
+        T r() const { return e[0];}
+        T g() const { return e[1];}
+        T b() const { return e[2];}
 
         // - operator returns the negated value of all elements
-        Vec3 operator-() const { 
-            return Vec3(-e[0], -e[1], -e[2]);
+        Vec3T operator-() const { 
+            return Vec3T(-e[0], -e[1], -e[2]);
         }
         
         // Vec3[i] returns e[i], also when asked by reference
-        double operator[](int i) const { return e[i]; }
-        double& operator[](int i) { return e[i]; }
+        T operator[](int i) const { return e[i]; }
+        T& operator[](int i) { return e[i]; }
 
         // Adding another vector to this through v1 (this) += v2 just adds all the components of v2 to v1 and returns v1;
-        Vec3& operator+=(const Vec3 &v) {
+        Vec3T& operator+=(const Vec3T &v) {
             e[0] += v.e[0];
             e[1] += v.e[1];
             e[2] += v.e[2];
@@ -37,7 +52,7 @@ class Vec3 {
         }
 
         // Subtracting another vector to this through v1 (this) -= v2 just subtracts all the components of v2 from v1 and returns v1;
-        Vec3& operator-=(const Vec3 &v) {
+        Vec3T& operator-=(const Vec3T &v) {
             e[0] -= v.e[0];
             e[1] -= v.e[1];
             e[2] -= v.e[2];
@@ -45,7 +60,7 @@ class Vec3 {
         }
 
         // Same for multiplication
-        Vec3& operator*=(const double t) {
+        Vec3T& operator*=(const T t) {
             e[0] *= t;
             e[1] *= t;
             e[2] *= t;
@@ -53,97 +68,118 @@ class Vec3 {
         }
 
         // Dividing by a number through v1 /= t returns the multiplied by 1/t vector.
-        Vec3& operator/=(const double t) {
+        Vec3T& operator/=(const T t) {
             return *this *= 1/t;
         }
 
         // Returns length of vector
-        double length() const {
+        T length() const {
             return sqrt(lengthSquared());
         }
 
-        // Squares and sums all components, returns the double.
-        double lengthSquared() const {
+        // Squares and sums all components, returns the scalar.
+        T lengthSquared() const {
             return e[0]*e[0] + e[1]*e[1] + e[2]*e[2];
         }
 
         // Generate a Vec3 with random elements [0,1]
-        inline static Vec3 random() {
-            return Vec3(randomDouble(), randomDouble(), randomDouble());
+        inline static Vec3T random() {
+            return Vec3T(randomDouble(), randomDouble(), randomDouble());
         }
 
         // Generate a Vec3 with random elements [min,max]
-        inline static Vec3 random(double min, double max) {
-            return Vec3(randomDouble(min, max), randomDouble(min, max), randomDouble(min, max));
+        inline static Vec3T random(double min, double max) {
+            return Vec3T(randomDouble(min, max), randomDouble(min, max), randomDouble(min, max));
         }
 
         // Function that determines whether the vector is near zero.
         bool nearZero() const {
             // Return true if the vector is near zero in all dimensions
-            const auto s = 1e-8;
+            const T s = std::is_same<T, float>::value ? 1e-6f : 1e-8;
             return (fabs(e[0]) < s) && (fabs(e[1]) < s) && (fabs(e[2]) < s);
         }
 
     public:
-        double e[3];
+        T e[3];
 };
 
 // Type aliases
+typedef Vec3T<Real> Vec3;
 using Point3 = Vec3;
 using Color = Vec3;
 
+// Makes the scalar argument of the operators below not take part in deducing T, so `2 * v` works for a float v too.
+template <typename T>
+struct NoDeduce { typedef T type; };
+
 
 // << output operator returns the 3 values of the vector like "e0 e1 e2"
-inline std::ostream& operator<<(std::ostream &out, const Vec3 &v) {
+template <typename T>
+inline std::ostream& operator<<(std::ostream &out, const Vec3T<T> &v) {
     return out << v.e[0] << ' ' << v.e[1] << ' ' << v.e[2];
 }
 
 // + operator sums the two vector references and returns a new one
-inline Vec3 operator+(const Vec3 &u, const Vec3 &v) {
-    return Vec3(u.e[0] + v.e[0], u.e[1] + v.e[1], u.e[2] + v.e[2]);
+template <typename T>
+inline Vec3T<T> operator+(const Vec3T<T> &u, const Vec3T<T> &v) {
+    return Vec3T<T>(u.e[0] + v.e[0], u.e[1] + v.e[1], u.e[2] + v.e[2]);
 }
 
 // See operator+
-inline Vec3 operator-(const Vec3 &u, const Vec3 &v) {
-    return Vec3(u.e[0] - v.e[0], u.e[1] - v.e[1], u.e[2] - v.e[2]);
+template <typename T>
+inline Vec3T<T> operator-(const Vec3T<T> &u, const Vec3T<T> &v) {
+    return Vec3T<T>(u.e[0] - v.e[0], u.e[1] - v.e[1], u.e[2] - v.e[2]);
 }
 
 // See operator+
-inline Vec3 operator*(const Vec3 &u, const Vec3 &v) {
-    return Vec3(u.e[0] * v.e[0], u.e[1] * v.e[1], u.e[2] * v.e[2]);
+template <typename T>
+inline Vec3T<T> operator*(const Vec3T<T> &u, const Vec3T<T> &v) {
+    return Vec3T<T>(u.e[0] * v.e[0], u.e[1] * v.e[1], u.e[2] * v.e[2]);
 }
 
-// Multiplying with a double `t` returns a new `Vec3` with each element multiplied by `t`
-inline Vec3 operator*(double t, const Vec3 &v) {
-    return Vec3(t*v.e[0], t*v.e[1], t*v.e[2]);
+// Multiplying with a scalar `t` returns a new `Vec3` with each element multiplied by `t`
+template <typename T>
+inline Vec3T<T> operator*(typename NoDeduce<T>::type t, const Vec3T<T> &v) {
+    return Vec3T<T>(t*v.e[0], t*v.e[1], t*v.e[2]);
 }
 
-// Multiplying with a double `t` returns a new `Vec3` with each element multiplied by `t`
-inline Vec3 operator*(const Vec3 &v, double t) {
+// Multiplying with a scalar `t` returns a new `Vec3` with each element multiplied by `t`
+template <typename T>
+inline Vec3T<T> operator*(const Vec3T<T> &v, typename NoDeduce<T>::type t) {
     return t * v;
 }
 
-// Dividing a `Vec3 v` with a double `t` returns the result of multiplying `v` with `1/t`.
-inline Vec3 operator/(Vec3 v, double t) {
+// Dividing a `Vec3 v` with a scalar `t` returns the result of multiplying `v` with `1/t`.
+template <typename T>
+inline Vec3T<T> operator/(Vec3T<T> v, typename NoDeduce<T>::type t) {
     return (1/t) * v;
 }
 
+// Two vectors are equal if all their components are.
+template <typename T>
+inline bool operator==(const Vec3T<T> &u, const Vec3T<T> &v) {
+    return u.e[0] == v.e[0] && u.e[1] == v.e[1] && u.e[2] == v.e[2];
+}
+
 // Dot product.
-inline double dot(const Vec3 &u, const Vec3 &v) {
+template <typename T>
+inline T dot(const Vec3T<T> &u, const Vec3T<T> &v) {
     return u.e[0] * v.e[0]
          + u.e[1] * v.e[1]
          + u.e[2] * v.e[2];
 }
 
 // Cross product.
-inline Vec3 cross(const Vec3 &u, const Vec3 &v) {
-    return Vec3(u.e[1] * v.e[2] - u.e[2] * v.e[1],
-                u.e[2] * v.e[0] - u.e[0] * v.e[2],
-                u.e[0] * v.e[1] - u.e[1] * v.e[0]);
+template <typename T>
+inline Vec3T<T> cross(const Vec3T<T> &u, const Vec3T<T> &v) {
+    return Vec3T<T>(u.e[1] * v.e[2] - u.e[2] * v.e[1],
+                    u.e[2] * v.e[0] - u.e[0] * v.e[2],
+                    u.e[0] * v.e[1] - u.e[1] * v.e[0]);
 }
 
 // Unit vector.
-inline Vec3 unitVector(Vec3 v) {
+template <typename T>
+inline Vec3T<T> unitVector(Vec3T<T> v) {
     return v / v.length();
 }
 
@@ -0,0 +1,282 @@
+#ifndef WAVEFRONT_H
+#define WAVEFRONT_H
+
+#include "tracer.h"
+#include "corporeal.h"
+#include "material.h"
+#include "aabb.h"
+
+#include <algorithm>
+#include <atomic>
+#include <cstdint>
+#include <iostream>
+#include <typeindex>
+#include <vector>
+
+// A pixel of the image, row `i` counted from the bottom and column `j`.
+struct Pixel {
+    int i, j;
+};
+
+/**
+ * The same light transport as rayColor, but for many paths at once and a stage at a time instead of one path
+ * recursively. Paths live in slots of a fixed size state, one array per field, and each stage works through a queue
+ * of the slots it has to handle:
+ *
+ *   generate:  fills free slots with camera rays for samples that haven't been started.
+ *   intersect: finds the closest hit of every ray in its queue, sorting them into hits and misses.
+ *   miss:      adds the background the ray sees and frees its slot.
+ *   shade:     finishes the hit, adds what it emits and scatters the path on, back into the intersect queue.
+ *
+ * Each stage is a loop over one kind of work, so its code and data stay hot, rather than one path at a time
+ * jumping between traversal, materials and textures. A path contributes emitted light weighted by the product of the
+ * attenuations before it, exactly what the recursion in rayColor sums up.
+ *
+ * The shade stage first finishes all its hits and sorts them by material, its class first and then the instance, so
+ * every material's scatter (and the textures it reads) runs over one stretch of hits instead of hits in whatever order
+ * they came back from intersection. How long those stretches get is counted, see report().
+ *
+ * Rays after the first bounce leave in all directions from all over the scene, and tracing them in the order they
+ * were scattered has every ray fetch other parts of the BVH than the one before it. With `reorderRays` the intersect
+ * stage first orders its queue: camera rays stay in pixel order, the other rays go in bins by the octant of their direction and
+ * their origin, quantised to a grid over the scene and laid out along a Morton curve. Rays in the same bin start close
+ * together and go the same way, so they visit much the same nodes, and with RAY_PACKETS they are traced as packets.
+ * It's off by default: on the demo scenes the BVH stays in cache anyway, and sorting only paid off for the instanced
+ * scene traced without packets.
+ *
+ * The tracer has no light sampling, so there are no shadow rays and no stage for them.
+ */
+class WavefrontIntegrator {
+    public:
+        WavefrontIntegrator(const Corporeal& world, const Color& background, int maxDepth, uint32_t capacity = 1 << 14,
+            bool sortByMaterial = true, bool reorderRays = false)
+            : world(world), background(background), maxDepth(maxDepth), capacity(capacity), sortByMaterial(sortByMaterial),
+              reorderRays(reorderRays) {
+            rays.resize(capacity);
+            throughput.resize(capacity);
+            pixel.resize(capacity);
+            depth.resize(capacity);
+            hits.resize(capacity);
+        }
+
+        // Traces `samples` paths through every pixel and adds their colors to `colors`, one per pixel.
+        void render(const std::vector<Pixel>& pixels, int samples, std::vector<Color>& colors);
+
+        // Prints how coherent shading was over all integrators: the average number of hits in a row with the same
+        //  material, as they came out of intersection and as they were shaded.
+        static void report(std::ostream& out);
+
+    private:
+        void generate(const std::vector<Pixel>& pixels, int samples);
+        void reorder();
+        void intersect();
+        void miss(std::vector<Color>& colors);
+        void shade(std::vector<Color>& colors);
+
+        const Corporeal& world;
+        Color background;
+        int maxDepth;
+        uint32_t capacity;
+        bool sortByMaterial;
+        bool reorderRays;
+        // What ray origins are quantised over when reordering.
+        AABB sceneBounds;
+
+        // Path state, indexed by slot.
+        std::vector<Ray> rays;
+        std::vector<Color> throughput;
+        std::vector<uint32_t> pixel;
+        std::vector<int> depth;
+        std::vector<HitRecord> hits;
+
+        // Slots waiting for each stage, and the ones not in use.
+        std::vector<uint32_t> freeSlots;
+        std::vector<uint32_t> intersectQueue;
+        std::vector<uint32_t> shadeQueue;
+        std::vector<uint32_t> missQueue;
+        // The next sample to start, counting through all pixels for sample 0, then 1 and so on.
+        uint64_t nextSample;
+
+        struct ShadeKey {
+            std::type_index type;
+            const Material* material;
+            uint32_t slot;
+            bool operator<(const ShadeKey& other) const {
+                return type != other.type ? type < other.type : material < other.material;
+            }
+        };
+        std::vector<ShadeKey> shadeKeys;
+        // Bin, then slot.
+        std::vector<std::pair<uint64_t, uint32_t>> rayKeys;
+
+        // Hits shaded, and the runs of hits with the same material before and after sorting, for all integrators.
+        static std::atomic<uint64_t> shadedHits;
+        static std::atomic<uint64_t> runsIntersected;
+        static std::atomic<uint64_t> runsShaded;
+};
+
+std::atomic<uint64_t> WavefrontIntegrator::shadedHits(0);
+std::atomic<uint64_t> WavefrontIntegrator::runsIntersected(0);
+std::atomic<uint64_t> WavefrontIntegrator::runsShaded(0);
+
+void WavefrontIntegrator::report(std::ostream& out) {
+    uint64_t hits = shadedHits;
+    if (hits == 0) return;
+    out << "Wavefront shading: " << hits << " hits, " << (double)hits / runsIntersected << " in a row with the same"
+        << " material from intersection, " << (double)hits / runsShaded << " as shaded\n";
+}
+
+void WavefrontIntegrator::render(const std::vector<Pixel>& pixels, int samples, std::vector<Color>& colors) {
+    freeSlots.clear();
+    for (uint32_t slot = capacity; slot > 0; slot--) freeSlots.push_back(slot - 1);
+    intersectQueue.clear();
+    shadeQueue.clear();
+    missQueue.clear();
+    nextSample = 0;
+    bool bounded = world.boundingBox(shutterOpen, shutterClose, sceneBounds);
+
+    // Finished paths free their slots for new camera rays, so the stages keep working on full queues until the very
+    //  last samples.
+    while (true) {
+        generate(pixels, samples);
+        if (intersectQueue.empty()) break;
+        if (reorderRays && bounded) reorder();
+        intersect();
+        miss(colors);
+        shade(colors);
+    }
+}
+
+void WavefrontIntegrator::generate(const std::vector<Pixel>& pixels, int samples) {
+    const uint64_t total = (uint64_t)pixels.size() * samples;
+    while (!freeSlots.empty() && nextSample < total) {
+        uint32_t slot = freeSlots.back();
+        freeSlots.pop_back();
+        // Neighbouring slots get neighbouring pixels, so the camera rays in the queue are in a coherent order.
+        uint32_t p = (uint32_t)(nextSample % pixels.size());
+        nextSample++;
+
+        auto u = (pixels[p].j + randomDouble()) / (imageWidth - 1);
+        auto v = (pixels[p].i + randomDouble()) / (imageHeight - 1);
+        rays[slot] = cam.getRay(u, v);
+        throughput[slot] = Color(1, 1, 1);
+        pixel[slot] = p;
+        depth[slot] = 0;
+        intersectQueue.push_back(slot);
+    }
+}
+
+// Spreads the lowest 10 bits of `x` out to every third bit.
+inline uint32_t spreadBits(uint32_t x) {
+    x &= 0x3ff;
+    x = (x | (x << 16)) & 0x30000ff;
+    x = (x | (x << 8)) & 0x300f00f;
+    x = (x | (x << 4)) & 0x30c30c3;
+    x = (x | (x << 2)) & 0x9249249;
+    return x;
+}
+
+void WavefrontIntegrator::reorder() {
+    Vec3 extent = sceneBounds.max() - sceneBounds.min();
+    rayKeys.clear();
+    for (size_t k = 0; k < intersectQueue.size(); k++) {
+        uint32_t slot = intersectQueue[k];
+        const Ray& r = rays[slot];
+        uint64_t key;
+        if (depth[slot] == 0) {
+            // Camera rays are coherent in the order they were generated.
+            key = k;
+        } else {
+            uint32_t cell[3];
+            uint32_t octant = 0;
+            for (int a = 0; a < 3; a++) {
+                double f = extent[a] > 0 ? (r.orig[a] - sceneBounds.min()[a]) / extent[a] : 0;
+                cell[a] = (uint32_t)(clamp(f, 0.0, 1.0) * 1023);
+                octant |= (r.dir[a] < 0) << a;
+            }
+            uint32_t morton = spreadBits(cell[0]) | spreadBits(cell[1]) << 1 | spreadBits(cell[2]) << 2;
+            key = 1ull << 40 | (uint64_t)octant << 30 | morton;
+        }
+        rayKeys.push_back(std::make_pair(key, slot));
+    }
+    std::sort(rayKeys.begin(), rayKeys.end());
+    for (size_t k = 0; k < rayKeys.size(); k++) intersectQueue[k] = rayKeys[k].second;
+}
+
+void WavefrontIntegrator::intersect() {
+    // tMin is 0.001 to solve floating point bugs around 0, as in rayColor.
+    #ifdef RAY_PACKETS
+    for (size_t first = 0; first < intersectQueue.size(); first += packetSize) {
+        int count = (int)std::min((size_t)packetSize, intersectQueue.size() - first);
+        RayPacket packet;
+        PacketHits packetHits;
+        for (int k = 0; k < count; k++) {
+            packet.add(rays[intersectQueue[first + k]]);
+            packetHits.tMax[k] = infinity;
+        }
+        world.hitPacket(packet, packet.allRays(), 0.001, packetHits);
+        for (int k = 0; k < count; k++) {
+            uint32_t slot = intersectQueue[first + k];
+            if (packetHits.hitMask & (1u << k)) {
+                hits[slot] = packetHits.rec[k];
+                shadeQueue.push_back(slot);
+            } else missQueue.push_back(slot);
+        }
+    }
+    #else
+    for (uint32_t slot : intersectQueue) {
+        if (world.hit(rays[slot], 0.001, infinity, hits[slot])) shadeQueue.push_back(slot);
+        else missQueue.push_back(slot);
+    }
+    #endif
+    intersectQueue.clear();
+}
+
+void WavefrontIntegrator::miss(std::vector<Color>& colors) {
+    for (uint32_t slot : missQueue) {
+        colors[pixel[slot]] += throughput[slot] * background;
+        freeSlots.push_back(slot);
+    }
+    missQueue.clear();
+}
+
+void WavefrontIntegrator::shade(std::vector<Color>& colors) {
+    // The material is only known once a hit is finished.
+    shadeKeys.clear();
+    for (uint32_t slot : shadeQueue) {
+        hits[slot].finish(rays[slot]);
+        const Material* material = hits[slot].matPtr.get();
+        shadeKeys.push_back(ShadeKey{ std::type_index(typeid(*material)), material, slot });
+    }
+    uint64_t before = 0, after = 0;
+    for (size_t k = 0; k < shadeKeys.size(); k++) before += k == 0 || shadeKeys[k].material != shadeKeys[k - 1].material;
+    if (sortByMaterial) std::sort(shadeKeys.begin(), shadeKeys.end());
+    for (size_t k = 0; k < shadeKeys.size(); k++) after += k == 0 || shadeKeys[k].material != shadeKeys[k - 1].material;
+    shadedHits += shadeKeys.size();
+    runsIntersected += before;
+    runsShaded += after;
+
+    for (const ShadeKey& key : shadeKeys) {
+        uint32_t slot = key.slot;
+        HitRecord& rec = hits[slot];
+        const Ray& r = rays[slot];
+        colors[pixel[slot]] += throughput[slot] * rec.matPtr->emitted(rec.u, rec.v, rec.p);
+
+        Ray scattered;
+        Color attenuation;
+        // rayColor stops after maxDepth hits, the next ray would only bring back black.
+        if (depth[slot] + 1 < maxDepth && rec.matPtr->scatter(r, rec, attenuation, scattered)) {
+            rays[slot] = scattered;
+            throughput[slot] = throughput[slot] * attenuation;
+            depth[slot]++;
+            intersectQueue.push_back(slot);
+        } else {
+            freeSlots.push_back(slot);
+        }
+        // Don't keep the material alive through the slot.
+        rec.matPtr = nullptr;
+    }
+    shadeQueue.clear();
+}
+
+#endif